@@ -0,0 +1,110 @@
+#ifndef ClupaSnapshot_h
+#define ClupaSnapshot_h 1
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace EVENT{
+  class LCCollection ;
+}
+
+namespace clupatra_new{
+
+  /** Binary snapshot of the Clupatra input for replaying the pattern recognition without LCIO files and
+   *  the DD4hep geometry. The file starts with a SnapshotHeader holding the TPC geometry and the B-field,
+   *  followed for every event by a SnapshotEvent and its nHit SnapshotHit records. All records are plain
+   *  structs with a size that is a multiple of 8 bytes, so the file can be memory mapped and used in place.
+   *  All lengths are in mm, the B-field in Tesla.
+   */
+  struct SnapshotHeader{
+    char     magic[8] ;      // "CLUPASNP"
+    uint32_t version ;
+    uint32_t maxRow ;
+    double   bField ;
+    double   driftLength ;
+    double   zHalf ;
+    double   rMin ;
+    double   rMax ;
+    double   rMinReadout ;
+    double   rMaxReadout ;
+    double   padHeight ;
+    double   padWidth ;
+    double   padGap ;
+  } ;
+
+  struct SnapshotEvent{
+    uint32_t magic ;         // SnapshotEvent::Magic
+    uint32_t nHit ;
+    int32_t  run ;
+    int32_t  event ;
+
+    enum{ Magic = 0x45565431 } ;
+  } ;
+
+  struct SnapshotHit{
+    double  pos[3] ;
+    float   cov[6] ;
+    int32_t cellID0 ;
+    int32_t cellID1 ;
+    float   eDep ;
+    float   time ;
+  } ;
+
+  //------------------------------------------------------------------------------------------
+
+  /** Writes the TrackerHits of the TPC input collection of every event to a snapshot file. */
+  class SnapshotWriter{
+  public:
+
+    /** Create the file and write the header (the magic and version are set here) - throws an lcio::Exception on failure. */
+    SnapshotWriter( const std::string& fileName, const SnapshotHeader& header ) ;
+
+    ~SnapshotWriter() ;
+
+    /** Append the hits in col (TrackerHits) as event. */
+    void write( int run, int event, EVENT::LCCollection* col ) ;
+
+    unsigned nEvents() const { return _nEvt ; }
+
+  protected:
+    SnapshotWriter( const SnapshotWriter& ) ;
+    SnapshotWriter& operator=( const SnapshotWriter& ) ;
+
+    FILE* _file ;
+    std::vector< SnapshotHit > _buffer{} ;
+    unsigned _nEvt ;
+  } ;
+
+  //------------------------------------------------------------------------------------------
+
+  /** Reads a snapshot file through a read-only memory map - the records are used in place. */
+  class SnapshotReader{
+  public:
+
+    /** Map the file and check the header - throws an lcio::Exception on failure. */
+    explicit SnapshotReader( const std::string& fileName ) ;
+
+    ~SnapshotReader() ;
+
+    const SnapshotHeader& header() const { return *reinterpret_cast<const SnapshotHeader*>( _data ) ; }
+
+    /** The next event and its hits - false at the end of the file. */
+    bool next( const SnapshotEvent*& evt, const SnapshotHit*& hits ) ;
+
+    /** Start again with the first event. */
+    void rewind() { _pos = sizeof( SnapshotHeader ) ; }
+
+  protected:
+    SnapshotReader( const SnapshotReader& ) ;
+    SnapshotReader& operator=( const SnapshotReader& ) ;
+
+    const char* _data ;
+    size_t _size ;
+    size_t _pos ;
+  } ;
+
+}
+
+#endif
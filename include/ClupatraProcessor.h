@@ -10,6 +10,7 @@
 #include "DDRec/DetectorData.h"
 
 #include <string>
+#include <vector>
 
 
 // forward declarations
@@ -17,6 +18,16 @@ namespace MarlinTrk{
   class IMarlinTrkSystem ;
 }
 
+namespace clupatra_new{
+  class StageCounters ;
+  class ClupaWorkspace ;
+  class SnapshotWriter ;
+  class SliceCarryOver ;
+  class HoughSeeder ;
+  class CASeeder ;
+  class KalTrackBudget ;
+}
+
 namespace EVENT{ 
   class Track ;
 }
@@ -35,16 +46,32 @@ namespace EVENT{
  *   @parameter OutputCollection         Name of the output collection with final TPC tracks
  *   @parameter SegmentCollectionName    Name of the output collection that has the individual track segments
  *   @parameter CreateDebugCollections   optionally create some debug collection with intermediate track segments and used and unused hits
+ *   @parameter ReuseSeedState           keep the Kalman track of a track segment after its extension and use it instead of the final refit, if the hits have not changed since - the kept tracks count in KalTrackBudgetMB
+ *   @parameter SeedDiagnostics          collect hit count, layer span and chi2 of rejected seed clusters in the stage counters printed in end()
+ *   @parameter ExportDebugExtensions    attach the delta chi2 of the fit to the TPC hits as LCRTRelations extension - only needed for CED picking and debugging
+ *   @parameter DebugCollectionTrackStates  bit mask of the track states computed for tracks in the debug collections: 1=AtIP, 2=AtFirstHit, 4=AtLastHit, 8=AtCalorimeter
+ *   @parameter DeferTrackStates         compute the (expensive) track states at the IP (propagated) and at the calorimeter face only for the tracks in the final output collection
  * 
  *   @parameter DistanceCut              Cut for distance between hits in mm for the seed finding
  *   @parameter Chi2Cut                  the maximum chi2-distance for which a hit is considered for merging
  *   @parameter CosAlphaCut              Cut for max.angle between hits in consecutive layers for seed finding - NB value should be smaller than 1 - default is 0.9999999 
  *   @parameter MaxDeltaChi2             the maximum delta Chi2 after filtering for which a hit is added to a track segement
+ *   @parameter FitPrefixHits            number of hits fitted in one go before the remaining hits are filtered one by one, when fitting a cluster - 0: all hits
+ *   @parameter MinFitHitFraction        a cluster is refitted with a twice larger max. chi2 increment if less than this fraction of the (prefix) hits are used in the fit
  * 
  *   @parameter DuplicatePadRowFraction  allowed fraction of hits in same pad row per track
  *   @parameter NLoopForSeeding          number of seed finding loops - every loop increases the distance cut by DistanceCut/NLoopForSeeding
+ *   @parameter SeedingEngine            seed finding in the pad row windows: NNWindows (NN clustering), Hough (conformal mapping Hough transform) or CA (cellular automaton)
+ *   @parameter HoughPhiBins             number of bins in the direction phi of the circle centre for SeedingEngine=Hough
+ *   @parameter HoughKappaBins           number of curvature bins for SeedingEngine=Hough - up to the curvature of tracks that just reach the TPC
+ *   @parameter HoughZCut                maximum distance [mm] in z of a hit from the straight line in z vs. arc length for SeedingEngine=Hough
+ *   @parameter CAMaxCurvature           maximum curvature [1/mm] of the circle through three hits in adjacent pad rows for SeedingEngine=CA - dominated by the hit resolution
+ *   @parameter CAZTolerance             maximum distance [mm] in z of the middle hit from the line through the outer hits for SeedingEngine=CA
+ *   @parameter CAMaxDoubletsPerHit      maximum number of doublets to the next inner pad row per hit (nearest hits within DistanceCut) for SeedingEngine=CA
  *   @parameter NumberOfZBins            number of bins in z over total length of TPC - hits from different z bins are nver merged
  *   @parameter PadRowRange              number of pad rows used in initial seed clustering
+ *   @parameter ReclusterInnerZFraction   hits within this fraction of the drift length in |z| and within ReclusterInnerRhoFraction are excluded from the global reclustering of leftover hits
+ *   @parameter ReclusterInnerRhoFraction hits within this fraction of the radial extent of the readout (from the inner readout radius) and within ReclusterInnerZFraction are excluded from the global reclustering
  * 
  *   @parameter MaxStepWithoutHit                 the maximum number of layers without finding a hit before hit search search is stopped 
  *   @parameter MinLayerFractionWithMultiplicity  minimum fraction of layers that have a given multiplicity, when forcing a cluster into sub clusters
@@ -63,6 +90,18 @@ namespace EVENT{
  *   @parameter pickUpSiHits             try to pick up hits from Si-trackers
  *   @parameter SITHitCollection         name of the SIT hit collections - used to extend TPC tracks if (pickUpSiHits==true)
  *   @parameter VXDHitCollection         name of the VXD hit collections - used to extend TPC tracks if (pickUpSiHits==true)
+ *   @parameter SiMaxMissedLayers        stop the pick up of silicon hits after this many consecutive layers without a hit (0: no limit)
+ *   @parameter SiAcceptanceCheck        skip silicon layers where the track's helix from the IP is outside the half length of the layer
+ *   @parameter SiAcceptanceZTolerance   tolerance [mm] added to the half length of a silicon layer in the acceptance check
+ *   @parameter SnapshotFile             name of a binary file the TPC input hits and the TPC geometry are written to, for replaying the pattern recognition with clupaReplay - not written if empty
+ *   @parameter TimeSliceMode            streaming mode for a continuous readout: events are (overlapping) time slices, tracks that can still gain hits are carried over to the next slice
+ *   @parameter SliceOverlapTime         tracks with a hit within this time [ns] of the latest hit in the slice are carried over (TimeSliceMode)
+ *   @parameter MaxCarriedSlices         maximum number of slices a track candidate is carried over before it is emitted (TimeSliceMode) - the candidates deferred in the last slice are only written as segments
+ *   @parameter CarriedHitsCollection    name of the collection with the copies of the hits carried over from the previous slice (TimeSliceMode)
+ *   @parameter KeepFinalFitTracksMB     memory budget [MB] for keeping the Kalman tracks of the final refit, so that the pick up of silicon hits continues from the fitted state (0: off)
+ *   @parameter KeepFinalFitRhoTolerance a kept Kalman track is only used for the pick up if its last filtered state is within this distance [mm] in rho of the innermost hit
+ *   @parameter KalTrackBudgetMB         memory budget [MB] for the Kalman tracks alive at the same time - stages that would exceed it fit and release one track at a time (0: no limit)
+ *   @parameter KalTrackSizeMB           estimated size [MB] of one Kalman track, used for KalTrackBudgetMB and KeepFinalFitTracksMB
  * 
  *   @parameter Verbosity               verbosity level of this processor ("DEBUG0-4,MESSAGE0-4,WARNING0-4,ERROR0-4,SILENT")
  * 
@@ -130,10 +169,22 @@ class ClupatraProcessor : public marlin::Processor {
   float  _dChi2Max {};
   float  _chi2Cut {};
   int    _maxStep {}; 
+  int    _fitPrefixHits {};
+  float  _minFitHitFraction {};
 
   float _minLayerFractionWithMultiplicity {};
   int   _minLayerNumberWithMultiplicity {};
   int   _nLoop {};
+
+  std::string _seedingEngine {};
+  int   _houghPhiBins {};
+  int   _houghKappaBins {};
+  float _houghZCut {};
+  clupatra_new::HoughSeeder* _houghSeeder {};
+  float _caMaxCurvature {};
+  float _caZTolerance {};
+  int   _caMaxDoublets {};
+  clupatra_new::CASeeder* _caSeeder {};
   
   float _trackStartsInnerDist {};
   float _trackEndsOuterCentralDist {};
@@ -142,6 +193,8 @@ class ClupatraProcessor : public marlin::Processor {
   
   int   _minCluSize {};
   int   _padRowRange {}; 
+  float _reclusterInnerZFraction {};
+  float _reclusterInnerRhoFraction {};
   int   _nZBins {};
 
   bool _MSOn {};
@@ -150,6 +203,11 @@ class ClupatraProcessor : public marlin::Processor {
   bool _pickUpSiHits {};
 
   bool _createDebugCollections {};
+  bool _deferTrackStates {};
+  bool _seedDiagnostics {};
+  bool _reuseSeedState {};
+  bool _exportDebugExtensions {};
+  int  _debugTrackStates {};
 
   int _caloFaceBarrelID {};
   int _caloFaceEndcapID {};
@@ -163,6 +221,31 @@ class ClupatraProcessor : public marlin::Processor {
 
   const dd4hep::rec::FixedPadSizeTPCData*  _tpc {};
 
+  int  _nSITLayers {};
+  int  _nVXDLayers {};
+  std::vector<double> _siLayerR {};
+  std::vector<double> _siLayerZHalf {};
+  int  _siMaxMissedLayers {};
+  bool _siAcceptanceCheck {};
+  float _siAcceptanceZTolerance {};
+  float _keepFinalFitMB {};
+  float _keepFinalFitRhoTolerance {};
+  float _kalTrackBudgetMB {};
+  float _kalTrackSizeMB {};
+  clupatra_new::KalTrackBudget* _kalBudget {};
+
+  clupatra_new::StageCounters* _counters {};
+  clupatra_new::ClupaWorkspace* _workspace {};
+
+  std::string _snapshotFile {};
+  clupatra_new::SnapshotWriter* _snapshot {};
+
+  bool  _timeSliceMode {};
+  float _sliceOverlapTime {};
+  int   _maxCarriedSlices {};
+  std::string _carriedHitsColName {};
+  clupatra_new::SliceCarryOver* _carryOver {};
+
 } ;
 
 #endif
@@ -4,6 +4,7 @@
 
 #include <list>
 #include <vector>
+#include <atomic>
 
 #include "LCRTRelations.h"
 
@@ -71,6 +72,24 @@ namespace nnclu {
   } ;
 
 
+  /** Summary of properties of all elements in a Cluster that is kept up to date incrementally
+   *  while elements are added or clusters are merged, so that it can be read in O(1) by the 
+   *  algorithms using the clusters. The generic version is empty - specialize it for the 
+   *  element type T as needed, implementing the three methods below.
+   *
+   *  @see Cluster::summary()
+   */
+  template <class T>
+  struct ClusterSummary{
+    /** reset to the state of an empty cluster */
+    void reset() {}
+    /** update with one more element */
+    void add( const T* ) {}
+    /** update with all elements of another cluster */
+    void merge( const ClusterSummary& ) {}
+  } ;
+
+
   /** Helper class that creates an Elements for an objects of type T.
    */
   template <class T>
@@ -164,6 +183,7 @@ namespace nnclu {
     typedef typename base::reverse_iterator reverse_iterator;
     typedef typename base::const_reverse_iterator const_reverse_iterator;
     typedef typename base::const_reference  const_reference;
+    typedef ClusterSummary<T> summary_type ;
 
     int ID{} ; //DEBUG
   
@@ -182,15 +202,35 @@ namespace nnclu {
     void sort( Compare comp ) { base::sort( comp ) ; }
     const_reference front() const { return base::front() ; }
     const_reference back() const { return base::back() ; }
-    void clear() { base::clear() ; }
+    void clear() { base::clear() ; _summary.reset() ; _summaryValid = true ; }
     bool empty() const { return base::empty() ; };
-    iterator erase( iterator pos ) { return base::erase( pos ) ; }
-    iterator erase( const_iterator pos ) { return base::erase( pos ) ; }
-    void merge( Cluster& other ) { base::merge( other ) ; }
+    iterator erase( iterator pos ) { _summaryValid = false ; return base::erase( pos ) ; }
+    iterator erase( const_iterator pos ) { _summaryValid = false ; return base::erase( pos ) ; }
+    void merge( Cluster& other ) { 
+      if( _summaryValid && other._summaryValid ) 
+        _summary.merge( other._summary ) ;
+      else
+        _summaryValid = false ;
+      base::merge( other ) ; 
+      other.clear() ;
+    }
+
+    /** Summary of the elements in this cluster - updated incrementally by addElement() and mergeClusters(),
+     *  recomputed from the elements if it has been invalidated by erase() or freeElements().
+     */
+    const summary_type& summary() const {
+      if( ! _summaryValid ){
+        _summary.reset() ;
+        for( const_iterator it = begin(), end = this->end() ; it != end ; ++it )
+          _summary.add( (*it)->first ) ;
+        _summaryValid = true ;
+      }
+      return _summary ;
+    }
 
     /** C'tor that takes the first element */
     Cluster( Element<T>* element)  {
-      static int SID=0 ;  //DEBUG
+      static std::atomic<int> SID( 0 ) ;  //DEBUG
       ID = SID++ ;      //DEBUG
       addElement( element ) ;
     }
@@ -200,6 +240,19 @@ namespace nnclu {
     
       element->second = this ;
       base::push_back( element ) ;
+
+      if( _summaryValid )
+        _summary.add( element->first ) ;
+    }
+
+    /** Add an element at the front of the cluster - allows to keep the elements ordered */
+    void addElementFront( Element<T>* element ) {
+    
+      element->second = this ;
+      base::push_front( element ) ;
+
+      if( _summaryValid )
+        _summary.add( element->first ) ;
     }
 
     // /** Remove all elements from the cluster and reset the cluster association, i.e. elements can be
@@ -223,6 +276,7 @@ namespace nnclu {
       for( typename Cluster<T>::iterator it = this->begin(), end = this->end() ; it != end ; it++ ){
         (*it)->second = 0 ;
       }
+      _summaryValid = false ;
     }
     
     /** Merges all elements from the other cluster cl into this cluster */
@@ -249,6 +303,10 @@ namespace nnclu {
       
       }
     }
+
+  protected:
+    mutable summary_type _summary{} ;
+    mutable bool _summaryValid = true ;
   } ;
 
 
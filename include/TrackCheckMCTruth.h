@@ -3,6 +3,7 @@
 
 #include "marlin/Processor.h"
 #include "lcio.h"
+#include "TrackValidation.h"
 #include <vector>
 #include <string>
 
@@ -68,6 +69,15 @@ class TrackCheckMCTruth : public Processor {
   FloatVec _ptRange {};
 
   std::vector< TH1* > _h1 {};
+
+  trkval::MCTruthIndex _mcTruth {};
+
+  bool _fillHistograms {};
+  std::string _tupleFileName {};
+
+  std::string _accumulatorFile {};
+  StringVec _mergeAccumulatorFiles {};
+  trkval::ValidationOutput* _output {};
   
   int _nRun {};
   int _nEvt {};
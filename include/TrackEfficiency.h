@@ -3,6 +3,7 @@
 
 #include "marlin/Processor.h"
 #include "lcio.h"
+#include "TrackValidation.h"
 #include <vector>
 #include <string>
 
@@ -60,6 +61,15 @@ class TrackEfficiency : public Processor {
   std::string _trkColName {};
 
   std::vector< TH1* > _h1 {};
+
+  trkval::MCTruthIndex _mcTruth {};
+
+  bool _fillHistograms {};
+  std::string _tupleFileName {};
+
+  std::string _accumulatorFile {};
+  StringVec _mergeAccumulatorFiles {};
+  trkval::ValidationOutput* _output {};
   
   FloatVec _ptRange {};
 
@@ -0,0 +1,325 @@
+#ifndef TrackValidation_h
+#define TrackValidation_h 1
+
+#include "lcio.h"
+#include "EVENT/LCCollection.h"
+#include "EVENT/MCParticle.h"
+#include "EVENT/Track.h"
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+
+class TFile ;
+class TTree ;
+
+/** Helper classes shared by the track validation processors TrackEfficiency and TrackCheckMCTruth.
+ *
+ *  @author F.Gaede, DESY
+ *  @version $Id$
+ */
+namespace trkval{
+
+  /** Per-event MC truth tables: every MCParticle of the input collection gets a dense index, the number
+   *  of sim hits per MCParticle is kept in a flat array and the relation between tracks and MCParticles
+   *  is converted once into compressed (CSR) adjacency arrays, i.e. for every MCParticle the related tracks
+   *  and weights are stored contiguously - in the order of the relation collection, as returned by the
+   *  LCRelationNavigator. The object is meant to be kept by the processor, so that the memory is reused.
+   */
+  class MCTruthIndex{
+  public:
+
+    /** Reset the tables and assign the dense indices to the MCParticles in col - call first in every event. */
+    void setMCParticles( EVENT::LCCollection* col ) ;
+
+    /** Number of indexed MCParticles. */
+    unsigned size() const { return _mcps.size() ; }
+
+    /** The dense index of the MCParticle - -1 if it is not in the MCParticle collection. */
+    int index( const EVENT::MCParticle* mcp ) const {
+      std::unordered_map< const EVENT::MCParticle*, int >::const_iterator it = _index.find( mcp ) ;
+      return ( it != _index.end()  ?  it->second  :  -1 ) ;
+    }
+
+    /** Count the sim hits per MCParticle in the SimTrackerHit collection col. */
+    void countSimHits( EVENT::LCCollection* col ) ;
+
+    /** Number of sim hits counted for the MCParticle with index i. */
+    int nSimHits( int i ) const { return ( i < 0  ?  0  :  _nSimHits[i] ) ; }
+
+    /** Convert the LCRelation between tracks and MCParticles - the MCParticles are the 'to' objects
+     *  of the relation for mcpIsTo==true (Track->MCParticle) and the 'from' objects otherwise.
+     */
+    void setRelation( EVENT::LCCollection* relCol , bool mcpIsTo=true ) ;
+
+    /** Number of tracks related to the MCParticle with index i. */
+    unsigned nTracks( int i ) const { return ( i < 0  ?  0  :  _offset[i+1] - _offset[i] ) ; }
+
+    /** The j-th track related to the MCParticle with index i. */
+    EVENT::Track* track( int i, unsigned j ) const { return _tracks[ _offset[i] + j ] ; }
+
+    /** The weight of the relation to the j-th track of the MCParticle with index i. */
+    float weight( int i, unsigned j ) const { return _weights[ _offset[i] + j ] ; }
+
+    /** Compute the number of related MCParticles and the largest relation weight for every track in trkCol
+     *  - from the relation set with setRelation().
+     */
+    void setTracks( EVENT::LCCollection* trkCol ) ;
+
+    /** Number of MCParticles related to the i-th track of the collection given in setTracks(). */
+    int nMCP( int i ) const { return _trkNMCP[i] ; }
+
+    /** Largest relation weight of the i-th track of the collection given in setTracks(). */
+    float trackWeight( int i ) const { return _trkWMax[i] ; }
+
+  protected:
+    std::unordered_map< const EVENT::MCParticle*, int > _index{} ;
+    std::vector< EVENT::MCParticle* > _mcps{} ;
+    std::vector< int >                _nSimHits{} ;
+    std::vector< unsigned >           _offset{} ;
+    std::vector< EVENT::Track* >      _tracks{} ;
+    std::vector< float >              _weights{} ;
+    std::vector< int >                _relMCP{} ;
+    std::vector< unsigned >           _fillPos{} ;
+    std::unordered_map< const EVENT::Track*, int > _trkIndex{} ;
+    std::vector< int >                _trkNMCP{} ;
+    std::vector< float >              _trkWMax{} ;
+  } ;
+
+  //------------------------------------------------------------------------------------------
+
+  /** Columns of the per-MCParticle rows of the validation tuple: the MC helix parameters, the number of sim
+   *  hits and related tracks, the largest relation weight and the parameters and errors of the best track.
+   */
+  namespace MCPColumn{
+    enum index{
+      d0mc, phimc, omegamc, z0mc, tanLmc, ptmc, costhmc,
+      nSimHits, nTrk, wMax, found,
+      d0,  phi,  omega,  z0,  tanL,  pt,
+      ed0, ephi, eomega, ez0, etanL, ept,
+      //-----  keep Size as last :
+      Size
+    } ;
+    extern const char* names[ Size ] ;
+  }
+
+  /** Columns of the per-track rows of the validation tuple. */
+  namespace TrackColumn{
+    enum index{
+      d0,  phi,  omega,  z0,  tanL,  pt,
+      ed0, ephi, eomega, ez0, etanL, ept,
+      nHit, nTPCHit, nMCP, wMax,
+      //-----  keep Size as last :
+      Size
+    } ;
+    extern const char* names[ Size ] ;
+  }
+
+  /** Fill the helix parameters d0, phi, omega, z0, tanL, pt and their errors into the consecutive columns
+   *  row[first] ... row[first+11] - as in MCPColumn and TrackColumn.
+   */
+  void fillTrackParameters( float* row, unsigned first, const EVENT::Track* trk, double alpha ) ;
+
+  class TupleWriter ;
+
+  /** Append one row per track in trkCol to the tuple - the truth index needs to have the relation set. */
+  void fillTrackTuple( TupleWriter& tuple, EVENT::LCCollection* trkCol, MCTruthIndex& truth, double alpha ) ;
+
+  //------------------------------------------------------------------------------------------
+
+  /** Columnar output of the validation: rows of float columns are appended to a buffer during the event
+   *  processing and written in batches to a ROOT TTree with one branch per column. Histograms can be
+   *  created from the tree offline, e.g. with different binning or cuts.
+   */
+  class TupleWriter{
+  public:
+
+    TupleWriter( const std::string& treeName, const char** columns, unsigned nColumns, unsigned batchSize=4096 ) ;
+
+    ~TupleWriter() ;
+
+    /** Create the tree in the given file - rows appended before are buffered until then. The current ROOT 
+     *  directory is not changed.
+     */
+    void create( TFile* file ) ;
+
+    /** Append a new row with all columns set to 0 - the returned pointer is valid until the next call. */
+    float* newRow() ;
+
+    /** Write the buffered rows to the tree. */
+    void flush() ;
+
+    /** Flush and write the tree to its file. */
+    void write() ;
+
+  protected:
+    TupleWriter( const TupleWriter& ) ;
+    TupleWriter& operator=( const TupleWriter& ) ;
+
+    std::string _name ;
+    std::vector< std::string > _columns ;
+    unsigned _batchSize ;
+    std::vector< float > _buffer{} ;
+    std::vector< float > _row{} ;
+    TTree* _tree ;
+  } ;
+
+  //------------------------------------------------------------------------------------------
+
+  /** Running mean and variance of a quantity (Welford's algorithm) - two objects can be merged exactly.
+   */
+  struct Moments{
+
+    Moments() : n(0), mean(0.), m2(0.) {}
+
+    void add( double x ){
+      ++n ;
+      double d = x - mean ;
+      mean += d / n ;
+      m2   += d * ( x - mean ) ;
+    }
+
+    void merge( const Moments& o ) ;
+
+    double variance() const { return ( n > 1  ?  m2 / ( n - 1 )  :  0. ) ; }
+
+    unsigned long n ;
+    double mean ;
+    double m2 ;
+  } ;
+
+  //------------------------------------------------------------------------------------------
+
+  /** Numerator and denominator of an efficiency in bins of some variable - values outside the bin range 
+   *  are ignored. Efficiencies from several jobs are combined by merging the counts.
+   */
+  class EfficiencyCounter{
+  public:
+
+    EfficiencyCounter( const std::vector<double>& binEdges ) ;
+
+    /** Count a true object at x that has been found or not. */
+    void fill( double x, bool found ) ;
+
+    /** Add the counts of o - the binning needs to be the same. */
+    void merge( const EfficiencyCounter& o ) ;
+
+    /** Write the bin edges and counts as text, such that they can be read with read(). */
+    void write( std::ostream& os ) const ;
+
+    /** Read the counts written with write(), replacing the current ones - throws an lcio::Exception if the 
+     *  format or binning does not match.
+     */
+    void read( std::istream& is ) ;
+
+    const std::vector<double>& edges() const { return _edges ; }
+    unsigned nBins() const { return _nTrue.size() ; }
+    double   low( unsigned i ) const { return _edges[i] ; }
+    double   high( unsigned i ) const { return _edges[i+1] ; }
+    unsigned long nTrue( unsigned i ) const { return _nTrue[i] ; }
+    unsigned long nFound( unsigned i ) const { return _nFound[i] ; }
+
+    /** Efficiency in bin i - 0 for empty bins. */
+    double efficiency( unsigned i ) const { return ( _nTrue[i]  ?  double( _nFound[i] ) / _nTrue[i]  :  0. ) ; }
+
+    /** Binomial error of the efficiency in bin i. */
+    double error( unsigned i ) const ;
+
+  protected:
+    std::vector<double>        _edges ;
+    std::vector<unsigned long> _nTrue ;
+    std::vector<unsigned long> _nFound ;
+  } ;
+
+  //------------------------------------------------------------------------------------------
+
+  /** Accumulates the tracking efficiency vs. pt, cos(theta) and |cos(theta)| and the moments of the pulls 
+   *  of the helix parameters d0, phi, omega, z0, tanL and pt. The fill methods can be called from several 
+   *  threads. The state can be written to and merged from text files, so that the results of many jobs 
+   *  are combined exactly in the end() of a final job.
+   */
+  class ValidationAccumulator{
+  public:
+
+    enum{ nPulls = 6 } ;
+
+    ValidationAccumulator( const std::vector<double>& ptEdges , unsigned nCosThetaBins ) ;
+
+    /** Count a true MCParticle, that has been found or not. */
+    void fillTruth( double pt, double cosTheta, bool found ) ;
+
+    /** Add the pulls (d0, phi, omega, z0, tanL, pt) of a found track. */
+    void fillPulls( const double* pulls ) ;
+
+    /** Add the state of o - the binning needs to be the same. */
+    void merge( const ValidationAccumulator& o ) ;
+
+    /** Write the state as text, such that it can be read with read(). */
+    void write( std::ostream& os ) const ;
+
+    /** Read and merge the state written with write() - throws an lcio::Exception if the format or binning does not match,
+     *  in which case nothing is merged.
+     */
+    void read( std::istream& is ) ;
+
+    /** Print the efficiencies with binomial errors and the mean and width of the pulls. */
+    void print( std::ostream& os ) const ;
+
+  protected:
+    ValidationAccumulator( const ValidationAccumulator& ) ;
+    ValidationAccumulator& operator=( const ValidationAccumulator& ) ;
+
+    mutable std::mutex _mutex{} ;
+    EfficiencyCounter _effPt ;
+    EfficiencyCounter _effCosTh ;
+    EfficiencyCounter _effAbsCosTh ;
+    Moments _pulls[ nPulls ] ;
+  } ;
+
+  //------------------------------------------------------------------------------------------
+
+  /** The output of a validation processor: the ValidationAccumulator and, optionally, the validation tuples 
+   *  <name>_mcp and <name>_trk in a ROOT file. Created in init() and deleted after end() of the processor.
+   */
+  class ValidationOutput{
+  public:
+
+    /** Create the accumulator and - if tupleFileName is not empty - the tuple file. The current ROOT directory 
+     *  is not changed, so that histograms booked later on do not end up in the tuple file.
+     */
+    ValidationOutput( const std::string& name, const std::vector<double>& ptEdges, unsigned nCosThetaBins, 
+		      const std::string& tupleFileName ) ;
+
+    ~ValidationOutput() ;
+
+    ValidationAccumulator& accumulator() { return _accumulator ; }
+
+    /** Append a row for the MCParticle with index iMCP to the MCParticle tuple and fill the MC helix parameters, 
+     *  pt, cos(theta) and the numbers of sim hits and related tracks - 0 if no tuple is written.
+     */
+    float* newMCPRow( int iMCP, const MCTruthIndex& truth, double d0, double phi, double omega, double z0, double tanL, 
+		      double pt, double cosTheta ) ;
+
+    /** Append one row per track in trkCol to the track tuple, if it is written. */
+    void fillTrackTuple( EVENT::LCCollection* trkCol, MCTruthIndex& truth, double alpha ) ;
+
+    /** Merge the accumulator files of other jobs, print the summary, write the accumulator to accumulatorFile 
+     *  (if not empty) and write and close the tuple file - throws an lcio::Exception if a file cannot be read.
+     */
+    void end( const std::vector<std::string>& mergeFiles, const std::string& accumulatorFile ) ;
+
+  protected:
+    ValidationOutput( const ValidationOutput& ) ;
+    ValidationOutput& operator=( const ValidationOutput& ) ;
+
+    ValidationAccumulator _accumulator ;
+    TFile* _file ;
+    TupleWriter* _mcpTuple ;
+    TupleWriter* _trkTuple ;
+  } ;
+
+}
+
+#endif
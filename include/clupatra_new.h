@@ -7,6 +7,12 @@
 #include <math.h>
 #include <sstream>
 #include <memory>
+#include <climits>
+#include <cfloat>
+#include <iterator>
+#include <stdint.h>
+#include <unordered_map>
+#include <unordered_set>
 #include "assert.h"
 
 #include "NNClusterer.h"
@@ -19,6 +25,8 @@
 #include "lcio.h"
 #include "EVENT/TrackerHit.h"
 #include "IMPL/TrackImpl.h"
+#include "IMPL/LCCollectionVec.h"
+#include "IMPL/TrackStateImpl.h"
 #include "UTIL/Operators.h"
 #include "UTIL/CellIDDecoder.h"
 #include "UTIL/LCTrackerConf.h"
@@ -39,8 +47,9 @@ namespace lcio{
     ILDDecoder() :  lcio::CellIDDecoder<TrackerHit>( LCTrackerCellID::encoding_string() ) {} 
   } ;
 
+  // the decoder keeps the last decoded cellID - one per thread
   static const BitField64& ILD_cellID( TrackerHit* th ){
-    static ILDDecoder encoder;
+    thread_local static ILDDecoder encoder;
     return encoder( th );
   }
 
@@ -52,6 +61,9 @@ namespace lcio{
 
 namespace clupatra_new{
   
+  /** Region of the TPC a hit is in - assigned once when the clupa hits are created, see InnerCylinder. */
+  enum HitRegion { OuterRegion = 0 , InnerRegion = 1 } ;
+
   /** Small wrapper extension of the LCIO Hit
    */
   struct ClupaHit {
@@ -59,11 +71,13 @@ namespace clupatra_new{
     ClupaHit() :layer(-1), 
 		zIndex(-1), 
 		phiIndex(-1), 
+		region( OuterRegion ), 
 		lcioHit(0), 
 		pos(0.,0.,0.) {}
     int layer ;
     int zIndex ;
     int phiIndex ;
+    HitRegion region ;
     lcio::TrackerHit* lcioHit ;
     dd4hep::rec::Vector3D pos ;
 
@@ -71,6 +85,62 @@ namespace clupatra_new{
   
   //  inline lcio::TrackerHit* lcioHit( const ClupaHit* h) { return h->lcioHit ; }
 
+} // namespace
+
+namespace nnclu{
+
+  /** Summary of a cluster of ClupaHits: number of hits, layer and z range and energy deposit - updated 
+   *  incrementally when hits are added to the cluster. Only O(1) quantities are kept here, as every
+   *  temporary cluster carries a summary - the hit multiplicities per layer are computed on demand 
+   *  with clupatra_new::LayerMultiplicities.
+   */
+  template <>
+  struct ClusterSummary< clupatra_new::ClupaHit >{
+
+    unsigned size{} ;
+    int minLayer{} ;
+    int maxLayer{} ;
+    double zMin{} ;
+    double zMax{} ;
+    double eDep{} ;
+
+    ClusterSummary() { reset() ; }
+
+    void reset() {
+      size = 0 ;
+      minLayer = INT_MAX ;
+      maxLayer = -1 ;
+      zMin =  1e99 ;
+      zMax = -1e99 ;
+      eDep = 0. ;
+    }
+
+    void add( const clupatra_new::ClupaHit* h ) {
+
+      ++size ;
+      if( h->layer < minLayer ) minLayer = h->layer ;
+      if( h->layer > maxLayer ) maxLayer = h->layer ;
+      if( h->pos.z() < zMin ) zMin = h->pos.z() ;
+      if( h->pos.z() > zMax ) zMax = h->pos.z() ;
+      if( h->lcioHit ) eDep += h->lcioHit->getEDep() ;
+    }
+
+    void merge( const ClusterSummary& o ) {
+
+      if( o.size == 0 ) 
+	return ;
+
+      size += o.size ;
+      if( o.minLayer < minLayer ) minLayer = o.minLayer ;
+      if( o.maxLayer > maxLayer ) maxLayer = o.maxLayer ;
+      if( o.zMin < zMin ) zMin = o.zMin ;
+      if( o.zMax > zMax ) zMax = o.zMax ;
+      eDep += o.eDep ;
+    }
+  } ;
+}
+
+namespace clupatra_new{
   
 //------------------ typedefs for elements and clusters ---------
 
@@ -91,12 +161,26 @@ namespace clupatra_new{
   
   //------------------------------------------------------------------------------------------
  
-  struct GHit : lcrtrel::LCExtension<GHit, Hit > {} ;
   
   //------------------------------------------------------------------------------------------
 
   struct MarTrk : lcrtrel::LCExtension<MarTrk, MarlinTrk::IMarlinTrack> {} ;
 
+  //------------------------------------------------------------------------------------------
+
+  /** Hit multiplicities per layer of a cluster - computed from the hits when needed by the heuristics
+   *  that split clusters, only the layers that have hits are counted ( hits with negative layers are ignored ).
+   */
+  struct LayerMultiplicities{
+
+    LayerMultiplicities( const CluTrack* clu ) ;
+
+    /** number of hits in layers that have more than one hit */
+    unsigned nDuplicate{} ;
+    /** nLayersWithMult[m] : number of layers with exactly m hits ( m > 0 ) */
+    std::vector<unsigned> nLayersWithMult ;
+  } ;
+
   //------------------------------------------------------------------------------------------
   
   struct DChi2 : lcrtrel::LCFloatExtension<DChi2> {} ; 
@@ -109,21 +193,132 @@ namespace clupatra_new{
   class ZIndex{
   public:
     /** C'tor takes zmin and zmax - NB index can be negative and larger than N */
-    ZIndex( float zmin , float zmax , int n ) : _zmin( zmin ), _zmax( zmax ) , _N (n) {}  
+    ZIndex( float zmin , float zmax , int n ) : _zmin( zmin ), _zmax( zmax ) , _N (n) , _scale( n / ( zmax - zmin ) ) {}  
 
     template <class T>
     inline int operator() (T* hit) {  
       
-      return (int) std::floor( ( hit->getPosition()[2] - _zmin ) / ( _zmax - _zmin ) * _N ) ; 
+      return index( hit->getPosition()[2] ) ; 
     }
     
-    inline int index( double z) {  return  (int) std::floor( ( z - _zmin ) / ( _zmax - _zmin ) * _N ) ;  } 
+    inline int index( double z) {  return  (int) std::floor( ( z - _zmin ) * _scale ) ;  } 
 
   protected:
     ZIndex() {} ;
     float _zmin{} ;
     float _zmax{} ;
     int _N{} ;
+    double _scale{} ; // N / ( zmax - zmin )
+  } ;
+
+  //------------------------------------------------------------------------------------------
+
+  /** Inner cylinder |z| <= zMax and rho <= rhoMax of the TPC - hits inside are in the InnerRegion and are
+   *  excluded from the global reclustering of the leftover hits.
+   */
+  class InnerCylinder{
+  public:
+    InnerCylinder( double zMax , double rhoMax ) : _zMax( zMax ) , _rhoMax2( rhoMax * rhoMax ) {}  
+
+    inline HitRegion region( const double* p ) const {  
+      return ( std::abs( p[2] ) > _zMax  ||  p[0]*p[0] + p[1]*p[1] > _rhoMax2  ?  OuterRegion  :  InnerRegion ) ;
+    } 
+
+  protected:
+    double _zMax ;
+    double _rhoMax2 ;
+  } ;
+
+  //------------------------------------------------------------------------------------------
+
+  /** Forward iterator over the (leftover) hits in the pad rows outerRow down to minRow+1 of a HitListVector,  
+   *  skipping the hits in the excluded region - the region is a tag of the hit, nothing is computed per hit.
+   *  The default c'tor creates the end iterator.
+   */
+  class RegionHitIterator{
+  public:
+    typedef std::forward_iterator_tag iterator_category ;
+    typedef Hit*                      value_type ;
+    typedef std::ptrdiff_t            difference_type ;
+    typedef Hit* const*               pointer ;
+    typedef Hit* const&               reference ;
+
+    RegionHitIterator() : _hLV(0), _row(0), _minRow(0), _excluded( OuterRegion ) {}
+
+    RegionHitIterator( HitListVector& hLV, int outerRow, int minRow, HitRegion excludedRegion ) : 
+      _hLV( &hLV ), _row( outerRow ), _minRow( minRow ), _excluded( excludedRegion ) {
+
+      if( _row > _minRow ){
+	_it = hLV[ _row ].begin() ;
+	skip() ;
+      }
+    }
+
+    reference operator*() const { return *_it ; }
+
+    RegionHitIterator& operator++() { ++_it ; skip() ; return *this ; }
+
+    RegionHitIterator operator++(int) { RegionHitIterator tmp( *this ) ; ++(*this) ; return tmp ; }
+
+    bool operator==( const RegionHitIterator& o ) const {
+      return atEnd() == o.atEnd() && ( atEnd() || ( _row == o._row && _it == o._it ) ) ;
+    }
+    bool operator!=( const RegionHitIterator& o ) const { return !( *this == o ) ; }
+
+  protected:
+    bool atEnd() const { return _hLV == 0 || _row <= _minRow ; }
+
+    /** advance to the next hit not in the excluded region - possibly in one of the next inner rows */
+    void skip() {
+      while( _row > _minRow ){
+	for( HitList::iterator end = (*_hLV)[ _row ].end() ; _it != end ; ++_it )
+	  if( (*_it)->first->region != _excluded ) 
+	    return ;
+	if( --_row > _minRow ) 
+	  _it = (*_hLV)[ _row ].begin() ;
+      }
+    }
+
+    HitListVector* _hLV ;
+    int _row ;
+    int _minRow ;
+    HitRegion _excluded ;
+    HitList::iterator _it{} ;
+  } ;
+
+  //------------------------------------------------------------------------------------------
+
+  /** Fast decoding of one field of the cellID of tracker hits with a mask and shift that are computed 
+   *  once from the encoding string - avoids the BitField64 object of the CellIDDecoder per hit.
+   */
+  class CellIDField{
+  public:
+    CellIDField( const std::string& encoding, const std::string& name ){
+      lcio::BitField64 bf( encoding ) ;
+      const lcio::BitFieldValue& f = bf[ name ] ;
+      _mask     = f.mask() ;
+      _offset   = f.offset() ;
+      _width    = f.width() ;
+      _isSigned = f.isSigned() ;
+    }
+
+    inline int operator()( const lcio::TrackerHit* th ) const {
+
+      lcio::long64 id = ( lcio::long64( unsigned( th->getCellID0() ) ) | ( lcio::long64( th->getCellID1() ) << 32 ) ) ;
+
+      lcio::long64 val = ( id & _mask ) >> _offset ;
+
+      if( _isSigned && ( val & ( 1LL << ( _width - 1 ) ) ) )
+	val -= ( 1LL << _width ) ;
+
+      return int( val ) ;
+    }
+
+  protected:
+    lcio::long64 _mask{} ;
+    unsigned _offset{} ;
+    unsigned _width{} ;
+    bool _isSigned{} ;
   } ;
   
   //------------------------------------------------------------------------------------------
@@ -214,20 +409,51 @@ namespace clupatra_new{
   
 
 
+  //-----------------------------------------------
+
+  /** Replace the track state at the location of ts in place or add it, if the track has no state at this location -
+   *  the track state at the IP is always kept as the first one ( defines the track parameters ). 
+   *  The track takes ownership of ts, the replaced state is deleted.
+   */
+  void replaceTrackState( lcio::TrackImpl* trk, lcio::TrackStateImpl* ts ) ;
+
   //-----------------------------------------------
   
+  /** Converts a CluTrack into an lcio::Track - the track states given in TrackStates are computed from 
+   *  the IMarlinTrack attached to the cluster (if any).
+   */
   struct LCIOTrackConverter{
     
+    /** bit flags for selecting the track states that are computed */
+    enum{ 
+      AtIP           = 1 , 
+      AtFirstHit     = 2 , 
+      AtLastHit      = 4 , 
+      AtCalorimeter  = 8 , 
+      AllTrackStates = 15 
+    } ;
+
     bool UsePropagate ;
     unsigned CaloFaceBarrelID ; 
     unsigned CaloFaceEndcapID ; 
+    unsigned TrackStates ;
+    bool ExportDChi2 ;  // attach the delta chi2 of the hits in the fit as DChi2 extension (CED picking)
 
     LCIOTrackConverter() : UsePropagate(false ) , 
 			   CaloFaceBarrelID( lcio::ILDDetID::ECAL) , 
-			   CaloFaceEndcapID( lcio::ILDDetID::ECAL_ENDCAP){} 
+			   CaloFaceEndcapID( lcio::ILDDetID::ECAL_ENDCAP),
+			   TrackStates( AllTrackStates ),
+			   ExportDChi2( false ) {} 
 
     lcio::Track* operator() (CluTrack* c) ;
 
+    /** Compute the track states at the IP and/or at the calorimeter face ( states = AtIP | AtCalorimeter ) for an
+     *  already converted track, where the fitted IMarlinTrack no longer exists: the states are propagated with
+     *  a temporary track initialised from the track states at the first and last hit respectively.
+     *  Existing track states at these locations are replaced.
+     */
+    void addTrackStates( lcio::TrackImpl* trk, unsigned states, MarlinTrk::IMarlinTrkSystem* trkSys, double bfield ) const ;
+
   } ;
 
   //------------------------------------------------------------------------------------------
@@ -251,20 +477,9 @@ namespace clupatra_new{
     bool operator()(const CluTrack* cl) const {
  
       // check for duplicate layer numbers
-      std::vector<int> hLayer( _N )  ; 
-      typedef CluTrack::const_iterator IT ;
+      LayerMultiplicities lm( cl ) ;
 
-      unsigned nHit = 0 ;
-      for(IT it=cl->begin() ; it != cl->end() ; ++it ) {
-	++ hLayer[ (*it)->first->layer]   ;
-	++ nHit ;
-      } 
-      unsigned nDuplicate = 0 ;
-      for(unsigned i=0 ; i < _N ; ++i ) {
-	if( hLayer[i] > 1 ) 
-	  nDuplicate += hLayer[i] ;
-      }
-      return double(nDuplicate)/nHit > _f ;
+      return double( lm.nDuplicate ) / cl->summary().size > _f ;
     }
   };
 
@@ -287,15 +502,71 @@ namespace clupatra_new{
     
     MarlinTrk::IMarlinTrkSystem* _ts ;
     double _maxChi2Increment ; 
+    unsigned _nPrefixHits ;
+    double _minHitFraction ;
     
-    IMarlinTrkFitter(MarlinTrk::IMarlinTrkSystem* ts, double maxChi2Increment=DBL_MAX ) : 
+    /** If fewer than minHitFraction of the hits are used in the fit, the track is refitted once with twice the 
+     *  maxChi2Increment. If nPrefixHits > 0, only the first nPrefixHits hits (in fit direction) are fitted in one go 
+     *  and checked - the remaining hits are filtered one by one and the running fraction of accepted hits is checked.
+     *  For nPrefixHits = 0 all hits are fitted in one go.
+     */
+    IMarlinTrkFitter(MarlinTrk::IMarlinTrkSystem* ts, double maxChi2Increment=DBL_MAX, unsigned nPrefixHits=0, double minHitFraction=0.2 ) : 
       _ts( ts ) , 
-      _maxChi2Increment(maxChi2Increment) {}
+      _maxChi2Increment(maxChi2Increment), 
+      _nPrefixHits( nPrefixHits ),
+      _minHitFraction( minHitFraction ) {}
     
 
     MarlinTrk::IMarlinTrack* operator() (CluTrack* clu) ;
+
+    /** Sort the cluster and fill its hits in the order they are added to the track by operator() - the first nPrefix 
+     *  hits are fitted in one go. Returns true if the track is fitted in forward direction (incoming track segment).
+     */
+    bool hitOrder( CluTrack* clu, std::vector< lcio::TrackerHit* >& hits, unsigned& nPrefix ) const ;
   };
 
+  //------------------------------------------------------------------------------------------
+
+  class KalTrackBudget ;
+
+  /** Order independent hash of the hits in the cluster. */
+  size_t hitHash( const CluTrack* clu ) ;
+
+  /** The Kalman track of a cluster kept after the extension, with the number and the hash of the cluster's hits at that 
+   *  time, so that the final refit can be skipped if the hits have not changed since. Deletes the track and releases 
+   *  it from the budget, unless the track has been taken over with take().
+   */
+  struct ExtensionTrkStruct{
+
+    ExtensionTrkStruct( MarlinTrk::IMarlinTrack* t, unsigned n, size_t h, KalTrackBudget* b ) : 
+      trk( t ), nHit( n ), hash( h ), budget( b ) {}
+
+    ~ExtensionTrkStruct() ;
+
+    MarlinTrk::IMarlinTrack* take() { MarlinTrk::IMarlinTrack* t = trk ; trk = 0 ; return t ; }
+
+    MarlinTrk::IMarlinTrack* trk ;
+    unsigned nHit ;
+    size_t hash ;
+    KalTrackBudget* budget ;
+
+  private:
+    ExtensionTrkStruct( const ExtensionTrkStruct& ) ;
+    ExtensionTrkStruct& operator=( const ExtensionTrkStruct& ) ;
+  } ;
+  struct ExtensionTrk : lcrtrel::LCOwnedExtension<ExtensionTrk, ExtensionTrkStruct> {} ;
+
+  /** Keep trk, the Kalman track of the cluster after its extension, in the ExtensionTrk extension - if the budget leaves 
+   *  room for one more track. Returns false if the track is not kept, i.e. the caller still has to delete and release it.
+   */
+  bool keepExtensionTrk( CluTrack* clu, MarlinTrk::IMarlinTrack* trk, KalTrackBudget* budget ) ;
+
+  /** The Kalman track kept for the cluster after its extension, if it can replace the refit with fit: the hits of the 
+   *  cluster have not changed since and the hits used by the track are in the order fit would add them. The track is 
+   *  attached to the cluster (MarTrk) and remains counted in the budget - otherwise 0. The kept track is removed in any case.
+   */
+  MarlinTrk::IMarlinTrack* takeExtensionTrk( CluTrack* clu, const IMarlinTrkFitter& fit ) ;
+
   //-------------------------------------------------------------------------------------
 
   /** Try to add hits from hLV (hit lists per layer) to the cluster. The cluster needs to have a fitted KalTrack associated to it.
@@ -311,11 +582,175 @@ namespace clupatra_new{
    */
   bool addHitAndFilter( int detectorID, int layer, CluTrack* clu, HitListVector& hLV , double dChiMax, double chi2Cut) ; 
   
+  //------------------------------------------------------------------------------------------
+
+  //------------------------------------------------------------------------------------------
+
+  /** Extension of clusters, e.g. the sub-clusters of a split cluster: the Kalman track of a cluster is fitted, 
+   *  the cluster is extended with addHitsAndFilter forward and backward and its Kalman track (~1 MByte) is 
+   *  deleted right away - so only one Kalman track is alive at a time. The clusters of a list are extended 
+   *  in the order of the list, as they compete for the same hits. With keepTrks the Kalman tracks are kept for the 
+   *  final refit instead, as far as the budget allows (see keepExtensionTrk()).
+   */
+  class ClusterExtender{
+  public:
+
+    /** fitter: the fitter for the Kalman tracks of the clusters - counted in the budget, if given */
+    ClusterExtender( const IMarlinTrkFitter& fitter, HitListVector& hLV, ZIndex& zIndex, 
+		     double dChi2Max, double chi2Cut, unsigned maxStep, KalTrackBudget* budget=0, bool keepTrks=false ) : 
+      _fitter( fitter ), _hLV( &hLV ), _zIndex( &zIndex ), 
+      _dChi2Max( dChi2Max ), _chi2Cut( chi2Cut ), _maxStep( maxStep ), _budget( budget ), _keepTrks( keepTrks ) {}
+
+    /** extend all clusters in the list - returns the number of hits added */
+    int operator()( Clusterer::cluster_list& clusters ) ;
+
+    /** extend a single cluster - returns the number of hits added */
+    int operator()( CluTrack* clu ) ;
+
+  protected:
+    IMarlinTrkFitter _fitter ;
+    HitListVector* _hLV ;
+    ZIndex* _zIndex ;
+    double _dChi2Max ;
+    double _chi2Cut ;
+    unsigned _maxStep ;
+    KalTrackBudget* _budget ;
+    bool _keepTrks ;
+  } ;
+  
   //------------------------------------------------------------------------------------------
   /** Split up clusters that have a hit multiplicity of 2,3,4,...,N in at least layersWithMultiplicity. 
    */
   void split_multiplicity( Clusterer::cluster_list& cluList, int layersWithMultiplicity , int N=5) ;
 
+  /** Find seed clusters in the pad row window ( outerRow-padRowRange , outerRow ]: NN clustering of the hits with dCut, 
+   *  re-clustering of the hits in small clusters with 1.2*dCut, splitting of clusters according to the hit multiplicity 
+   *  and removal of clusters with too many duplicate pad rows. The seed clusters are added to sclu and their hits are 
+   *  removed from hitsInLayer. windowHits is used as buffer.
+   */
+  void findSeedClusters( HitListVector& hitsInLayer, HitVec& windowHits, int outerRow, int padRowRange, double dCut, double cosAlphaCut, 
+			 unsigned minCluSize, unsigned maxTPCLayers, float duplicatePadRowFraction, Clusterer::cluster_list& sclu ) ;
+
+  //------------------------------------------------------------------------------------------
+
+  /** Seeding with a coarse Hough transform - alternative to the NN clustering in pad row windows. The hits are 
+   *  in the pad row window ( outerRow-padRowRange , outerRow ] are
+   *  mapped to the conformal plane u = x/r^2, v = y/r^2, where circles through the origin become straight lines:
+   *  for every bin of the direction phi of the circle centre a hit votes for the curvature kappa = 2*(u*cos(phi)+v*sin(phi)).
+   *  As the circle is constrained to the origin, the curvature is measured also for the short segments in a window, 
+   *  while the combinatorial background per accumulator cell stays small. 
+   *  The votes are counted in integer accumulators, the loops over the hits are written such that the compiler
+   *  can vectorise them. The hits of the local maxima with at least minHits votes are checked for a straight line 
+   *  in z vs. the arc length s - outliers beyond zCut are dropped and at most one hit per layer is kept. The accepted 
+   *  seed clusters are added to seeds and their hits are removed from hitsInLayer. 
+   *  Only tracks from (close to) the IP are found - the remaining hits are left for the reclustering of leftover hits. 
+   *  The object keeps its buffers, so it should be reused for all events.
+   */
+  class HoughSeeder{
+  public:
+
+    HoughSeeder( unsigned nPhiBins, unsigned nKappaBins, double maxKappa, double zCut, unsigned minHits ) ;
+
+    /** Find seed clusters in the hits of the pad row window - returns the number of seeds found. */
+    unsigned findSeeds( HitListVector& hitsInLayer, int outerRow, int padRowRange, Clusterer::cluster_list& seeds ) ;
+
+  protected:
+
+    /** Compute the kappa bin of all hits for phi bin iPhi in _kBin - nKappa for hits outside the range. */
+    void computeKappaBins( unsigned iPhi ) ;
+
+    /** Check the hits of the accumulator cell ( iPhi, iKappa ) in z vs. s - returns a new cluster or 0. 
+     *  The indices of its hits are in _seedHits.
+     */
+    CluTrack* makeSeed( unsigned iPhi, unsigned iKappa ) ;
+
+    /** The kappa bin of a hit with conformal coordinates u, v for the phi bin with cos(phi)=c and sin(phi)=s. */
+    inline unsigned kappaBin( float u, float v, float c, float s ) const {
+      float k = 2.f * ( u * c + v * s ) * _kappaScale ;
+      return unsigned( ( k >= 0.f && k < float( _nKappa ) )  ?  k  :  float( _nKappa ) ) ;
+    }
+
+    unsigned _nPhi ;
+    unsigned _nKappa ;
+    float    _maxKappa ;
+    float    _kappaScale ;
+    double   _zCut ;
+    unsigned _minHits ;
+
+    std::vector<float> _cosPhi{} ;
+    std::vector<float> _sinPhi{} ;
+
+    // the free hits and their conformal coordinates - structure of arrays
+    std::vector<Hit*>  _hits{} ;
+    std::vector<float> _u{} ;
+    std::vector<float> _v{} ;
+    std::vector<float> _rho{} ;
+    std::vector<unsigned> _kBin{} ;
+
+    std::vector<uint16_t> _acc{} ;     // _nPhi * ( _nKappa + 1 ) - the last bin of every row is the overflow
+    std::vector< std::pair< unsigned, unsigned > > _peaks{} ;
+    std::vector<unsigned> _cand{} ;
+    std::vector<unsigned> _seedHits{} ;
+    std::vector<double> _s{} ;
+    std::vector<double> _res{} ;
+    std::vector<double> _tmp{} ;
+  } ;
+
+  //------------------------------------------------------------------------------------------
+
+  /** Seeding with a cellular automaton - alternative to the NN clustering in pad row windows with bounded 
+   *  work per hit. In the pad row window ( outerRow-padRowRange , outerRow ] doublets are built between hits 
+   *  in adjacent pad rows that are in neighbouring z bins (ClupaHit::zIndex) and closer than dCut - at most 
+   *  maxDoublets per hit. Doublets that share a hit are linked if the three hits are compatible: the curvature 
+   *  of the circle through them in r-phi is below maxKappa and the middle hit is within zTol of the straight 
+   *  line through the outer hits in z vs. rho. The state of a doublet is the length of the longest chain of 
+   *  linked doublets towards the inner rows - as the links only point inwards, the cellular automaton converges 
+   *  in one sweep from the innermost pair of rows. The longest chains are extracted as seed clusters, their hits 
+   *  are removed from hitsInLayer. Hits, doublets and links are kept in flat arrays with offsets per pad row,
+   *  every row only writes to its own range - so the loops over rows could be run in parallel.
+   */
+  class CASeeder{
+  public:
+
+    CASeeder( double dCut, double maxKappa, double zTol, unsigned maxDoublets, unsigned minHits ) ;
+
+    /** Find seed clusters in the hits of the pad row window - returns the number of seeds found. */
+    unsigned findSeeds( HitListVector& hitsInLayer, int outerRow, int padRowRange, Clusterer::cluster_list& seeds ) ;
+
+  protected:
+
+    /** Triplet test for the hits a (outer), b, c (inner) - indices in the flat hit arrays. */
+    bool compatible( unsigned a, unsigned b, unsigned c ) const ;
+
+    double   _dCut ;
+    double   _maxKappa ;
+    double   _zTol ;
+    unsigned _maxDoublets ;
+    unsigned _minHits ;
+
+    // hits of the window sorted in z per row - structure of arrays, row i in [ _hitOffset[i], _hitOffset[i+1] )
+    std::vector<Hit*>     _hits{} ;
+    std::vector<double>   _x{} ;
+    std::vector<double>   _y{} ;
+    std::vector<double>   _z{} ;
+    std::vector<double>   _rho{} ;
+    std::vector<unsigned> _hitOffset{} ;
+
+    // doublets ( outer hit, inner hit ) sorted by the outer hit - the doublets of hit h are [ _hitDoublets[h], _hitDoublets[h+1] )
+    std::vector<unsigned> _dOuter{} ;
+    std::vector<unsigned> _dInner{} ;
+    std::vector<unsigned> _hitDoublets{} ;
+
+    // links from a doublet to the compatible doublets starting at its inner hit - [ _linkOffset[d], _linkOffset[d+1] )
+    std::vector<unsigned> _links{} ;
+    std::vector<unsigned> _linkOffset{} ;
+
+    std::vector< std::pair< double, unsigned > > _cand{} ;
+    std::vector<unsigned> _state{} ;
+    std::vector<unsigned> _order{} ;
+    std::vector<unsigned> _chain{} ;
+  } ;
+
   //------------------------------------------------------------------------------------------
   /** Returns the number of rows where cluster clu has i hits in mult[i] for i=1,2,3,4,.... -
    *  mult[0] counts all rows that have hits
@@ -551,8 +986,10 @@ namespace clupatra_new{
   class TrackCircleDistance{
     
   public:
-    /** C'tor takes merge distance */
-    TrackCircleDistance(float dCut) : _dCutSquared( dCut*dCut ) , _dCut(dCut){}
+    /** C'tor takes merge distance and optionally a side table of track infos, indexed by the Index0 of the 
+     *  elements - otherwise the TrackInfo extension of the tracks is used 
+     */
+    TrackCircleDistance(float dCut, const std::vector<TrackInfoStruct>* infos=0 ) : _dCutSquared( dCut*dCut ) , _dCut(dCut), _infos( infos ){}
     
     /** Merge condition: ... */
     inline bool operator()( nnclu::Element<lcio::Track>* h0, nnclu::Element<lcio::Track>* h1){
@@ -562,8 +999,8 @@ namespace clupatra_new{
       lcio::Track* trk0 = h0->first ;
       lcio::Track* trk1 = h1->first ;
       
-      const TrackInfoStruct* ti0 =  trk0->ext<TrackInfo>() ;
-      const TrackInfoStruct* ti1 =  trk1->ext<TrackInfo>() ;
+      const TrackInfoStruct* ti0 =  ( _infos ? &(*_infos)[ h0->Index0 ] : trk0->ext<TrackInfo>() ) ;
+      const TrackInfoStruct* ti1 =  ( _infos ? &(*_infos)[ h1->Index0 ] : trk1->ext<TrackInfo>() ) ;
 
 
       streamlog_out( DEBUG2 ) << "TrackCircleDistance::operator() : " <<  trk0->id() << " <-> "  << trk1->id() 
@@ -674,6 +1111,7 @@ namespace clupatra_new{
   protected:
     float _dCutSquared ;
     float _dCut ;
+    const std::vector<TrackInfoStruct>* _infos ;
   } ; 
 
   //=======================================================================================
@@ -737,6 +1175,301 @@ namespace clupatra_new{
     std::vector< std::string > _names{} ;
   };
 
+  //=======================================================================================
+
+  /** Simple named counters for the processing stages that are accumulated over the job.
+   */
+  class StageCounters{
+  public:
+    StageCounters(){
+      _counts.reserve( 100 ) ;
+      _names.reserve( 100 ) ;
+    }
+
+    /** Register a counter with the given name - returns the index of an existing counter with the same name */
+    unsigned registerCounter( const std::string& name ){
+
+      for( unsigned i=0, N=_names.size() ; i<N ; ++i ) 
+	if( _names[i] == name ) 
+	  return i ;
+
+      _counts.push_back(0) ;
+      _names.push_back( name ) ;
+      return _counts.size() - 1 ;
+    }
+
+    void add(unsigned index, double val=1.){
+      _counts[ index ] += val ;
+    }
+
+    double get(unsigned index) const { return _counts[ index ] ; }
+
+
+    /** print all counters - with the average per event if nEvt>0 */
+    std::string toString( unsigned nEvt=0 ) const {
+      
+      std::stringstream s ;
+
+      s << " ============= StageCounters ======================== "  << std::endl ;
+      for( unsigned i=0, N=_counts.size() ;  i < N ; ++i){
+	s << "    " << _names[i] << " : " << _counts[i] ;
+	if( nEvt > 0 ) 
+	  s << "   ( per event: " << _counts[i] / nEvt << " )" ;
+	s << std::endl ;
+      } 
+      s << " ==================================================== "  << std::endl ;
+
+      return s.str() ;
+    }
+  protected:  
+    std::vector< double > _counts{} ;
+    std::vector< std::string > _names{} ;
+  };
+
+  //=======================================================================================
+
+  /** Book keeping of the live Kalman tracks (IMarlinTrack) of an event against a memory budget. The stages 
+   *  register the tracks they create (acquire) and delete (release). Before they hold on to several tracks at 
+   *  a time - e.g. the tracks kept for the pick up of silicon hits - they check available(): if the
+   *  budget does not allow it, they fit and release one track at a time instead and count this with countRelease().
+   *  The size of a track is an estimate per track - a budget of 0 means no limit.
+   */
+  class KalTrackBudget{
+  public:
+    KalTrackBudget( double budgetMB, double trackSizeMB ) : _budgetMB( budgetMB ), _trackSizeMB( trackSizeMB ) {}
+
+    /** start a new event - the peak and the number of releases are counted per event */
+    void newEvent() { _nLive = 0 ; _peak = 0 ; _nReleases = 0 ; }
+
+    /** the number of tracks that can be alive in addition to the current ones - UINT_MAX if there is no budget */
+    unsigned available() const {
+
+      if( _budgetMB <= 0. ) 
+	return UINT_MAX ;
+
+      unsigned nMax = unsigned( _budgetMB / _trackSizeMB ) ;
+
+      return ( nMax > _nLive  ?  nMax - _nLive  :  0 ) ;
+    }
+
+    void acquire( unsigned n=1 ){
+      _nLive += n ;
+      if( _nLive > _peak    ) _peak    = _nLive ;
+      if( _peak  > _maxPeak ) _maxPeak = _peak ;
+    }
+
+    void release( unsigned n=1 ){ _nLive = ( n < _nLive  ?  _nLive - n  :  0 ) ; }
+
+    /** count a stage that released its tracks earlier than it would have w/o the budget */
+    void countRelease( unsigned n=1 ){ _nReleases += n ; }
+
+    unsigned nLive()     const { return _nLive ; }
+    unsigned peak()      const { return _peak ; }
+    unsigned maxPeak()   const { return _maxPeak ; }
+    unsigned nReleases() const { return _nReleases ; }
+    double   trackSizeMB() const { return _trackSizeMB ; }
+
+  protected:
+    double _budgetMB ;
+    double _trackSizeMB ;
+    unsigned _nLive{} ;
+    unsigned _peak{} ;
+    unsigned _maxPeak{} ;   // over all events
+    unsigned _nReleases{} ;
+  } ;
+
+  //=======================================================================================
+
+  /** Buffers for the per-event data of the ClupatraProcessor that keep their memory between events: the clupa hits, 
+   *  the clustering hits (elements), the hits per layer and the hits in a pad row window. 
+   *  Call reset() at the start of the event. 
+   */
+  class ClupaWorkspace{
+  public:
+
+    std::vector<ClupaHit> clupaHits{} ;
+    std::vector<Hit>      hitPool{} ;     // the clustering hits - the HitVecs below hold pointers into this vector
+    HitVec                nncluHits{} ;   // does not own the hits
+    HitListVector         hitsInLayer{} ;
+    HitVec                windowHits{} ;  
+    std::vector<TrackInfoStruct> trackInfos{} ;  // side table for the track merging - indexed by the Index0 of the track elements
+
+    /** The clustering hit of the given lcio hit - 0 if there is none. The lookup table is sorted on first use in the event. */
+    Hit* hit( lcio::TrackerHit* th ) ;
+
+    /** Sort nncluHits in z - O(N) radix sort on the bit pattern of z (as float), replaces std::sort with ZSort. */
+    void sortHitsInZ() ;
+
+    /** Prepare the buffers for an event with (at most) nHit hits in nLayers layers. No more than nHit hits 
+     *  may be added to hitPool, as the pointers to them have to stay valid.
+     */
+    void reset( unsigned nHit, unsigned nLayers ){
+
+      clupaHits.assign( nHit , ClupaHit() ) ;
+
+      hitPool.clear() ;
+      hitPool.reserve( nHit ) ;
+
+      nncluHits.clear() ;
+      nncluHits.reserve( nHit ) ;
+
+      for( unsigned i=0, N=hitsInLayer.size() ; i<N ; ++i )
+	hitsInLayer[i].clear() ;
+      hitsInLayer.resize( nLayers ) ;
+
+      windowHits.clear() ;
+      windowHits.reserve( nHit ) ;
+
+      trackInfos.clear() ;
+
+      _hitLookup.clear() ;
+    }
+
+  protected:
+    std::vector< std::pair< lcio::TrackerHit*, Hit* > > _hitLookup{} ;
+    std::vector< std::pair< unsigned, Hit* > > _zKeys{} ;
+    std::vector< std::pair< unsigned, Hit* > > _zKeysTmp{} ;
+  };
+
+  //=======================================================================================
+
+  /** Book keeping for the streaming mode, where every event is a time slice of a continuous readout and 
+   *  consecutive slices may overlap. At the end of a slice the tracks with a hit within overlapTime of the 
+   *  latest hit in the slice can still gain hits: they are not emitted, instead copies of their hits are 
+   *  carried over and restored as track candidate in the next slice - together with copies of the unused 
+   *  hits in this boundary region. Hits of the next slice that have already been processed are skipped, 
+   *  so the overlap is not processed twice. A candidate is carried over at most maxSlices times, which 
+   *  bounds the latency and the work per slice.
+   */
+  class SliceCarryOver{
+  public:
+
+    SliceCarryOver( double overlapTime, unsigned maxSlices ) : _overlapTime( overlapTime ), _maxSlices( maxSlices ) {}
+
+    ~SliceCarryOver() ;
+
+    /** True if the hit has already been processed in the previous slice. */
+    bool seen( const lcio::TrackerHit* th ) const { return _seen.find( HitKey( th ) ) != _seen.end() ; }
+
+    /** The hits carried over from the previous slice - the caller takes ownership of the collection and
+     *  has to add it to the event, as the tracks of this slice will refer to its hits.
+     */
+    lcio::LCCollectionVec* takeHits() ;
+
+    /** Number of track candidates carried over from the previous slice. */
+    unsigned nCandidates() const { return _candidates.size() ; }
+
+    /** The indices of the hits of candidate i in the collection returned by takeHits(). */
+    const std::vector<int>& candidate( unsigned i ) const { return _candidates[i] ; }
+
+    /** Finish the slice: remember the hits in the input collection col, move the tracks in trkCol that can
+     *  still gain hits to segCol (flagged as SEGMENT) and copy their hits and the unused hits near the 
+     *  boundary for the next slice - hits are the clustering hits of the slice. If segCol is 0, the tracks 
+     *  in trkCol are copies of the segments and the deferred ones are deleted. Returns the number of 
+     *  deferred tracks.
+     */
+    unsigned endSlice( lcio::LCCollection* col, const HitVec& hits, lcio::LCCollectionVec* trkCol, lcio::LCCollectionVec* segCol ) ;
+
+    /** Drop the carried hits and track candidates, e.g. if a slice cannot be processed or after the last 
+     *  slice - returns the number of dropped candidates.
+     */
+    unsigned reset() ;
+
+  protected:
+    SliceCarryOver( const SliceCarryOver& ) ;
+    SliceCarryOver& operator=( const SliceCarryOver& ) ;
+
+    /** Identifies a hit independent of the LCIO object it is stored in. */
+    struct HitKey{
+      HitKey( const lcio::TrackerHit* th ) : cellID0( th->getCellID0() ), cellID1( th->getCellID1() ), 
+					     time( th->getTime() ), z( th->getPosition()[2] ) {}
+      bool operator==( const HitKey& o ) const { 
+	return cellID0 == o.cellID0 && cellID1 == o.cellID1 && time == o.time && z == o.z ; 
+      }
+      int cellID0 ;
+      int cellID1 ;
+      float time ;
+      double z ;
+    } ;
+
+    struct HitKeyHash{
+      size_t operator()( const HitKey& k ) const {
+	return std::hash<int>()( k.cellID0 ) ^ ( std::hash<int>()( k.cellID1 ) << 1 ) 
+	  ^ ( std::hash<float>()( k.time ) << 2 ) ^ ( std::hash<double>()( k.z ) << 3 ) ;
+      }
+    } ;
+
+    /** Copy the hit for the next slice (once) and return its index in _hits. */
+    int carry( lcio::TrackerHit* th, unsigned age ) ;
+
+    double   _overlapTime ;
+    unsigned _maxSlices ;
+    std::unordered_set< HitKey, HitKeyHash > _seen{} ;
+    std::vector< lcio::TrackerHit* > _hits{} ;      // copies for the next slice - owned until takeHits()
+    std::vector< unsigned > _hitAges{} ;
+    std::vector< std::vector<int> > _candidates{} ;
+    std::unordered_map< const lcio::TrackerHit*, int > _copyIndex{} ;   // index of the copy of a hit of this slice in _hits
+    std::unordered_map< const lcio::TrackerHit*, unsigned > _age{} ;    // number of slices a carried hit has been carried over
+  } ;
+
+  //=======================================================================================
+
+  /** Flat index of silicon tracker hits, built once per event: the hits are sorted by sensor ID and, 
+   *  within a sensor, by the local coordinate u along the sensor's measurement direction (the U direction
+   *  of the first TrackerHitPlane on the sensor or the z-axis otherwise). The hit closest to a given point 
+   *  on a sensor is then found by a binary search in u. Hits can be flagged as used and are ignored thereafter.
+   */
+  class SiHitIndex{
+  public:
+
+    /** distance metrics: 3D distance or distance along the sensor's measurement direction (strip hits) */
+    enum Metric{ Distance3D = 0 , StripDistance } ;
+
+    /** remove all hits */
+    void clear() ;
+
+    /** add a hit - the index needs to be sorted before it can be used */
+    void add( lcio::TrackerHit* hit ) { _entries.push_back( Entry( hit ) ) ; }
+
+    /** sort the hits and create the sensor table - call after all hits have been added */
+    void sort() ;
+
+    unsigned nSensors() const { return _sensors.size() ; }
+
+    /** number of (unused and used) hits on the given sensor */
+    unsigned nHits( int sensorID ) const ;
+
+    /** the closest unused hit on the given sensor - returns -1 if there is none ; d2 is the squared distance */
+    int findClosest( int sensorID, const dd4hep::rec::Vector3D& point, Metric metric, double& d2 ) const ;
+    
+    lcio::TrackerHit* hit( int index ) const { return _entries[ index ].hit ; }
+
+    /** flag the hit as used */
+    void setUsed( int index ) { _entries[ index ].used = true ; }
+
+  protected:
+
+    struct Entry{
+      Entry( lcio::TrackerHit* h ) : hit( h ), sensorID( h->getCellID0() ) {}
+      lcio::TrackerHit* hit ;
+      int sensorID ;
+      double u = 0. ;
+      bool used = false ;
+    } ;
+
+    struct Sensor{
+      int sensorID ;
+      unsigned begin ;
+      unsigned end ;
+      dd4hep::rec::Vector3D uDir ;
+    } ;
+
+    const Sensor* findSensor( int sensorID ) const ;
+
+    std::vector< Entry >  _entries{} ;
+    std::vector< Sensor > _sensors{} ;
+  };
+
 
 }
 #endif
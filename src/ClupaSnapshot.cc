@@ -0,0 +1,145 @@
+#include "ClupaSnapshot.h"
+
+#include "lcio.h"
+#include "EVENT/LCCollection.h"
+#include "EVENT/TrackerHit.h"
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace clupatra_new{
+
+  static_assert( sizeof( SnapshotHeader ) % 8 == 0 && sizeof( SnapshotEvent ) % 8 == 0 && sizeof( SnapshotHit ) % 8 == 0 ,
+		 "snapshot records need to keep 8 byte alignment" ) ;
+
+  static const char     snapshotMagic[8] = { 'C','L','U','P','A','S','N','P' } ;
+  static const uint32_t snapshotVersion  = 1 ;
+
+  //------------------------------------------------------------------------------------------
+
+  SnapshotWriter::SnapshotWriter( const std::string& fileName, const SnapshotHeader& header ) : _file(0), _nEvt(0) {
+
+    _file = std::fopen( fileName.c_str() , "wb" ) ;
+
+    if( _file == 0 )
+      throw lcio::Exception( "SnapshotWriter: cannot open file " + fileName ) ;
+
+    SnapshotHeader h( header ) ;
+    std::memcpy( h.magic , snapshotMagic , sizeof( h.magic ) ) ;
+    h.version = snapshotVersion ;
+
+    if( std::fwrite( &h , sizeof( h ) , 1 , _file ) != 1 )
+      throw lcio::Exception( "SnapshotWriter: cannot write header to " + fileName ) ;
+  }
+
+  SnapshotWriter::~SnapshotWriter(){
+
+    if( _file )
+      std::fclose( _file ) ;
+  }
+
+  void SnapshotWriter::write( int run, int event, EVENT::LCCollection* col ){
+
+    const int nHit = col->getNumberOfElements() ;
+
+    _buffer.resize( nHit ) ;
+
+    for( int i=0 ; i < nHit ; ++i ){
+
+      EVENT::TrackerHit* th = static_cast<EVENT::TrackerHit*>( col->getElementAt(i) ) ;
+      SnapshotHit& sh = _buffer[i] ;
+
+      const double* p = th->getPosition() ;
+      sh.pos[0] = p[0] ;
+      sh.pos[1] = p[1] ;
+      sh.pos[2] = p[2] ;
+
+      const EVENT::FloatVec& cov = th->getCovMatrix() ;
+      for( unsigned j=0 ; j<6 ; ++j )
+	sh.cov[j] = ( j < cov.size()  ?  cov[j]  :  0. ) ;
+
+      sh.cellID0 = th->getCellID0() ;
+      sh.cellID1 = th->getCellID1() ;
+      sh.eDep    = th->getEDep() ;
+      sh.time    = th->getTime() ;
+    }
+
+    SnapshotEvent se ;
+    se.magic = SnapshotEvent::Magic ;
+    se.nHit  = nHit ;
+    se.run   = run ;
+    se.event = event ;
+
+    if( std::fwrite( &se , sizeof( se ) , 1 , _file ) != 1 ||
+	( nHit > 0 && std::fwrite( &_buffer[0] , sizeof( SnapshotHit ) , nHit , _file ) != size_t( nHit ) ) )
+      throw lcio::Exception( "SnapshotWriter: write error" ) ;
+
+    ++_nEvt ;
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  SnapshotReader::SnapshotReader( const std::string& fileName ) : _data(0), _size(0), _pos(0) {
+
+    int fd = ::open( fileName.c_str() , O_RDONLY ) ;
+
+    if( fd < 0 )
+      throw lcio::Exception( "SnapshotReader: cannot open file " + fileName ) ;
+
+    struct stat st ;
+    if( ::fstat( fd , &st ) != 0 || size_t( st.st_size ) < sizeof( SnapshotHeader ) ){
+      ::close( fd ) ;
+      throw lcio::Exception( "SnapshotReader: not a snapshot file " + fileName ) ;
+    }
+
+    _size = st.st_size ;
+
+    void* data = ::mmap( 0 , _size , PROT_READ , MAP_PRIVATE , fd , 0 ) ;
+
+    ::close( fd ) ;
+
+    if( data == MAP_FAILED )
+      throw lcio::Exception( "SnapshotReader: cannot map file " + fileName ) ;
+
+    _data = static_cast<const char*>( data ) ;
+
+    if( std::memcmp( header().magic , snapshotMagic , sizeof( snapshotMagic ) ) != 0 || header().version != snapshotVersion ){
+      ::munmap( const_cast<char*>( _data ) , _size ) ;
+      throw lcio::Exception( "SnapshotReader: wrong format or version in " + fileName ) ;
+    }
+
+    rewind() ;
+  }
+
+  SnapshotReader::~SnapshotReader(){
+
+    if( _data )
+      ::munmap( const_cast<char*>( _data ) , _size ) ;
+  }
+
+  bool SnapshotReader::next( const SnapshotEvent*& evt, const SnapshotHit*& hits ){
+
+    if( _pos + sizeof( SnapshotEvent ) > _size )
+      return false ;
+
+    evt = reinterpret_cast<const SnapshotEvent*>( _data + _pos ) ;
+
+    size_t end = _pos + sizeof( SnapshotEvent ) + evt->nHit * sizeof( SnapshotHit ) ;
+
+    if( evt->magic != SnapshotEvent::Magic || end > _size )
+      throw lcio::Exception( "SnapshotReader: corrupt event record" ) ;
+
+    hits = reinterpret_cast<const SnapshotHit*>( _data + _pos + sizeof( SnapshotEvent ) ) ;
+
+    _pos = end ;
+
+    return true ;
+  }
+
+  //------------------------------------------------------------------------------------------
+
+}
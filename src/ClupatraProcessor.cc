@@ -1,6 +1,7 @@
 #include "ClupatraProcessor.h"
 
 #include "clupatra_new.h"
+#include "ClupaSnapshot.h"
 
 #include <time.h>
 #include <vector>
@@ -11,6 +12,7 @@
 #include <cmath>
 #include <memory>
 #include <float.h>
+#include <sys/resource.h>
 
 //---- MarlinUtil 
 #include "MarlinCED.h"
@@ -51,7 +53,8 @@ using namespace marlin ;
 
 using namespace clupatra_new ;
 
-#define WRITE_PICKED_DEBUG_TRACKS false
+// write the tracks picked in CED to the collection ClupatraDebugTracks - compiled in only if set to 1
+#define WRITE_PICKED_DEBUG_TRACKS 0
 
 /** helper method to create a track collections and add it to the event */
 inline LCCollectionVec* newTrkCol(const std::string& name, LCEvent * evt , bool isSubset=false){
@@ -159,10 +162,14 @@ struct MeanAbsZOfTrack{
   }
 };
 
+#if WRITE_PICKED_DEBUG_TRACKS
 //----------------------------------------------------------------
 //---- debug helper for writing track collection w/ picking in CED
 void printAndSaveTrack(const EVENT::LCObject* o ) ;
 
+/** Debug only ( WRITE_PICKED_DEBUG_TRACKS ): the collection is shared via static members, i.e. this
+ *  requires that only one processor instance processes one event at a time.
+ */
 class DebugTracks{
   friend void printAndSaveTrack(const EVENT::LCObject* o ) ;
 public:
@@ -202,6 +209,7 @@ void printAndSaveTrack(const EVENT::LCObject* o ){
 			     << " ==========" << std::endl ;
   }
 }
+#endif
 
 //----------------------------------------------------------------
 void printTrackerHit(const EVENT::LCObject* o){
@@ -287,6 +295,41 @@ ClupatraProcessor::ClupatraProcessor() : Processor("ClupatraProcessor") ,
  			      "number of seed finding loops - every loop increases the distance cut by DistanceCut/NLoopForSeeding"  ,
  			      _nLoop ,
  			      (int) 4 ) ;
+
+  registerProcessorParameter( "SeedingEngine" , 
+			      "seed finding in the pad row windows: NNWindows (NN clustering), Hough (conformal mapping Hough transform) or CA (cellular automaton)"  ,
+			      _seedingEngine ,
+			      std::string("NNWindows") ) ;
+
+  registerProcessorParameter( "HoughPhiBins" , 
+			      "number of bins in the direction phi of the circle centre for SeedingEngine=Hough"  ,
+			      _houghPhiBins ,
+			      (int) 360 ) ;
+
+  registerProcessorParameter( "HoughKappaBins" , 
+			      "number of curvature bins for SeedingEngine=Hough - up to the curvature of tracks that just reach the TPC"  ,
+			      _houghKappaBins ,
+			      (int) 128 ) ;
+
+  registerProcessorParameter( "HoughZCut" , 
+			      "maximum distance [mm] in z of a hit from the straight line in z vs. arc length for SeedingEngine=Hough"  ,
+			      _houghZCut ,
+			      (float) 20. ) ;
+
+  registerProcessorParameter( "CAMaxCurvature" , 
+			      "maximum curvature [1/mm] of the circle through three hits in adjacent pad rows for SeedingEngine=CA - dominated by the hit resolution"  ,
+			      _caMaxCurvature ,
+			      (float) 0.03 ) ;
+
+  registerProcessorParameter( "CAZTolerance" , 
+			      "maximum distance [mm] in z of the middle hit from the line through the outer hits for SeedingEngine=CA"  ,
+			      _caZTolerance ,
+			      (float) 5. ) ;
+
+  registerProcessorParameter( "CAMaxDoubletsPerHit" , 
+			      "maximum number of doublets to the next inner pad row per hit (nearest hits within DistanceCut) for SeedingEngine=CA"  ,
+			      _caMaxDoublets ,
+			      (int) 8 ) ;
   
   
   registerProcessorParameter( "MinimumClusterSize" , 
@@ -310,6 +353,16 @@ ClupatraProcessor::ClupatraProcessor() : Processor("ClupatraProcessor") ,
  			      _dChi2Max ,
  			      (float) 35. ) ;
 
+  registerProcessorParameter( "FitPrefixHits" , 
+ 			      "number of hits fitted in one go before the remaining hits are filtered one by one, when fitting a cluster - 0: all hits"  ,
+ 			      _fitPrefixHits ,
+ 			      (int) 0 ) ;
+
+  registerProcessorParameter( "MinFitHitFraction" , 
+ 			      "a cluster is refitted with a twice larger max. chi2 increment if less than this fraction of the (prefix) hits are used in the fit"  ,
+ 			      _minFitHitFraction ,
+ 			      (float) 0.2 ) ;
+
   registerProcessorParameter( "Chi2Cut" , 
  			      "the maximum chi2-distance for which a hit is considered for merging "  ,
  			      _chi2Cut ,
@@ -325,6 +378,16 @@ ClupatraProcessor::ClupatraProcessor() : Processor("ClupatraProcessor") ,
 			      "number of pad rows used in initial seed clustering"  ,
 			      _padRowRange ,
 			      (int) 12) ;
+
+  registerProcessorParameter( "ReclusterInnerZFraction" , 
+			      "hits within this fraction of the drift length in |z| and within ReclusterInnerRhoFraction are excluded from the global reclustering of leftover hits"  ,
+			      _reclusterInnerZFraction ,
+			      (float) 0.67 ) ;
+
+  registerProcessorParameter( "ReclusterInnerRhoFraction" , 
+			      "hits within this fraction of the radial extent of the readout (from the inner readout radius) and within ReclusterInnerZFraction are excluded from the global reclustering"  ,
+			      _reclusterInnerRhoFraction ,
+			      (float) 0.67 ) ;
  
   registerProcessorParameter( "NumberOfZBins" , 
 			      "number of bins in z over total length of TPC - hits from different z bins are nver merged"  ,
@@ -398,6 +461,91 @@ ClupatraProcessor::ClupatraProcessor() : Processor("ClupatraProcessor") ,
 			     _createDebugCollections,
 			     bool(false));
 
+  registerProcessorParameter("DeferTrackStates",
+			     "compute the (expensive) track states at the IP (propagated) and at the calorimeter face only for the tracks in the final output collection",
+			     _deferTrackStates,
+			     bool(false));
+
+  registerProcessorParameter("ExportDebugExtensions",
+			     "attach the delta chi2 of the fit to the TPC hits as LCRTRelations extension - only needed for CED picking and debugging",
+			     _exportDebugExtensions,
+			     bool(false));
+
+  registerProcessorParameter( "DebugCollectionTrackStates" , 
+			      "bit mask of the track states computed for tracks in the debug collections: 1=AtIP, 2=AtFirstHit, 4=AtLastHit, 8=AtCalorimeter",
+			      _debugTrackStates,
+			      (int) LCIOTrackConverter::AllTrackStates ) ;
+
+  registerProcessorParameter("ReuseSeedState",
+			     "keep the Kalman track of a track segment after its extension and use it instead of the final refit, if the hits have not changed since - the kept tracks count in KalTrackBudgetMB",
+			     _reuseSeedState,
+			     bool(false));
+
+  registerProcessorParameter("SeedDiagnostics",
+			     "collect hit count, layer span and chi2 of rejected seed clusters in the stage counters printed in end()",
+			     _seedDiagnostics,
+			     bool(false));
+
+  registerProcessorParameter("SnapshotFile",
+			     "name of a binary file the TPC input hits and the TPC geometry are written to, for replaying the pattern recognition with clupaReplay - not written if empty",
+			     _snapshotFile,
+			     std::string(""));
+
+  registerProcessorParameter("TimeSliceMode",
+			     "streaming mode for a continuous readout: events are (overlapping) time slices, tracks that can still gain hits are carried over to the next slice",
+			     _timeSliceMode,
+			     bool(false));
+
+  registerProcessorParameter("SliceOverlapTime",
+			     "tracks with a hit within this time [ns] of the latest hit in the slice are carried over (TimeSliceMode)",
+			     _sliceOverlapTime,
+			     float(100.));
+
+  registerProcessorParameter("MaxCarriedSlices",
+			     "maximum number of slices a track candidate is carried over before it is emitted (TimeSliceMode) - the candidates deferred in the last slice are only written as segments",
+			     _maxCarriedSlices,
+			     int(2));
+
+  registerProcessorParameter("CarriedHitsCollection",
+			     "name of the collection with the copies of the hits carried over from the previous slice (TimeSliceMode)",
+			     _carriedHitsColName,
+			     std::string("ClupatraCarriedTPCHits"));
+
+  registerProcessorParameter("KeepFinalFitTracksMB",
+			     "memory budget [MB] for keeping the Kalman tracks of the final refit, so that the pick up of silicon hits continues from the fitted state (0: off)",
+			     _keepFinalFitMB,
+			     float(0.));
+
+  registerProcessorParameter("KeepFinalFitRhoTolerance",
+			     "a kept Kalman track is only used for the pick up if its last filtered state is within this distance [mm] in rho of the innermost hit (KeepFinalFitTracksMB)",
+			     _keepFinalFitRhoTolerance,
+			     float(1.));
+
+  registerProcessorParameter("KalTrackBudgetMB",
+			     "memory budget [MB] for the Kalman tracks alive at the same time - stages that would exceed it fit and release one track at a time (0: no limit)",
+			     _kalTrackBudgetMB,
+			     float(0.));
+
+  registerProcessorParameter("KalTrackSizeMB",
+			     "estimated size [MB] of one Kalman track, used for KalTrackBudgetMB and KeepFinalFitTracksMB",
+			     _kalTrackSizeMB,
+			     float(1.));
+
+  registerProcessorParameter("SiMaxMissedLayers",
+			     "stop the pick up of silicon hits after this many consecutive layers without a hit (0: no limit)",
+			     _siMaxMissedLayers,
+			     int(0));
+
+  registerProcessorParameter("SiAcceptanceCheck",
+			     "skip silicon layers where the track's helix from the IP is outside the half length of the layer",
+			     _siAcceptanceCheck,
+			     bool(false));
+
+  registerProcessorParameter("SiAcceptanceZTolerance",
+			     "tolerance [mm] added to the half length of a silicon layer in the acceptance check (SiAcceptanceCheck)",
+			     _siAcceptanceZTolerance,
+			     float(5.));
+
   registerProcessorParameter( "TrackSystemName",
 			      "Name of the track fitting system to be used ( DDKalTest, aidaTT, ... )",
 			      _trkSystemName,
@@ -436,12 +584,106 @@ void ClupatraProcessor::init() {
   _trksystem->setOption( MarlinTrk::IMarlinTrkSystem::CFG::useSmoothing,  _SmoothOn) ;
   _trksystem->init() ;  
   
+  // --------  get the geometry information from the DD4hep model - the processor only reads it in processEvent()
+
+  dd4hep::Detector& lcdd = dd4hep::Detector::getInstance();
+  dd4hep::DetElement tpcDE = lcdd.detector("TPC") ;
+  _tpc = tpcDE.extension<dd4hep::rec::FixedPadSizeTPCData>() ;
+
+  double bfieldV[3] ;
+  lcdd.field().magneticField( { 0., 0., 0. }  , bfieldV  ) ;
+  _bfield = bfieldV[2]/dd4hep::tesla ;
+
+  // the number of SIT and VXD layers and their dimensions for the pick up of silicon hits 
+
+  _nSITLayers = 0 ;
+  _nVXDLayers = 0 ;
+  _siLayerR.clear() ;
+  _siLayerZHalf.clear() ;
+  
+  try{
+    
+    dd4hep::DetElement sitDE = lcdd.detector("SIT") ;
+    dd4hep::rec::ZPlanarData* sit = sitDE.extension<dd4hep::rec::ZPlanarData>() ;
+    
+    dd4hep::DetElement vxdDE = lcdd.detector("VXD") ;
+    dd4hep::rec::ZPlanarData* vxd = vxdDE.extension<dd4hep::rec::ZPlanarData>() ;
+    
+    _nSITLayers = sit->layers.size() ;
+    _nVXDLayers = vxd->layers.size() ;
+
+    // radius and half length of the sensitive layers - VXD first
+    for( unsigned i=0, N=vxd->layers.size() ; i<N ; ++i ){
+	_siLayerR.push_back(     vxd->layers[i].distanceSensitive / dd4hep::mm ) ;
+	_siLayerZHalf.push_back( vxd->layers[i].zHalfSensitive    / dd4hep::mm ) ;
+    }
+    for( unsigned i=0, N=sit->layers.size() ; i<N ; ++i ){
+	_siLayerR.push_back(     sit->layers[i].distanceSensitive / dd4hep::mm ) ;
+	_siLayerZHalf.push_back( sit->layers[i].zHalfSensitive    / dd4hep::mm ) ;
+    }
+    
+  }catch(...){ } // fixme
+
   _nRun = 0 ;
   _nEvt = 0 ;
   
+  _counters = new StageCounters ;
+
+  _kalBudget = new KalTrackBudget( _kalTrackBudgetMB , _kalTrackSizeMB ) ;
+
+  _workspace = new ClupaWorkspace ;
+
+  if( ! _snapshotFile.empty() ){
+
+    SnapshotHeader sh ;
+    sh.maxRow      = _tpc->maxRow ;
+    sh.bField      = _bfield ;
+    sh.driftLength = _tpc->driftLength / dd4hep::mm ;
+    sh.zHalf       = _tpc->zHalf / dd4hep::mm ;
+    sh.rMin        = _tpc->rMin / dd4hep::mm ;
+    sh.rMax        = _tpc->rMax / dd4hep::mm ;
+    sh.rMinReadout = _tpc->rMinReadout / dd4hep::mm ;
+    sh.rMaxReadout = _tpc->rMaxReadout / dd4hep::mm ;
+    sh.padHeight   = _tpc->padHeight / dd4hep::mm ;
+    sh.padWidth    = _tpc->padWidth / dd4hep::mm ;
+    sh.padGap      = _tpc->padGap / dd4hep::mm ;
+
+    _snapshot = new SnapshotWriter( _snapshotFile , sh ) ;
+
+    streamlog_out( MESSAGE ) << "  will write snapshot of the TPC input hits to " << _snapshotFile << std::endl ;
+  }
+
+  if( _seedingEngine == "Hough" ){
 
-  if( WRITE_PICKED_DEBUG_TRACKS ) 
-    CEDPickingHandler::getInstance().registerFunction( LCIO::TRACK  , &printAndSaveTrack ) ; 
+    // tracks from the IP need a radius of at least rMinReadout/2 to reach the TPC
+    double maxKappa = 2. / ( _tpc->rMinReadout / dd4hep::mm ) ;
+
+    _houghSeeder = new HoughSeeder( _houghPhiBins , _houghKappaBins , maxKappa , _houghZCut , _minCluSize ) ;
+
+    streamlog_out( MESSAGE ) << "  seeding with Hough transform in " << _houghPhiBins << " x " << _houghKappaBins << " bins " << std::endl ;
+
+  } else if( _seedingEngine == "CA" ){
+
+    _caSeeder = new CASeeder( _distCut , _caMaxCurvature , _caZTolerance , _caMaxDoublets , _minCluSize ) ;
+
+    streamlog_out( MESSAGE ) << "  seeding with cellular automaton - max. " << _caMaxDoublets << " doublets per hit " << std::endl ;
+
+  } else if( _seedingEngine != "NNWindows" ){
+
+    throw EVENT::Exception( std::string("  Unknown SeedingEngine: ") + _seedingEngine + " - use NNWindows, Hough or CA" ) ;
+  }
+
+  if( _timeSliceMode ){
+
+    _carryOver = new SliceCarryOver( _sliceOverlapTime , _maxCarriedSlices ) ;
+
+    streamlog_out( MESSAGE ) << "  streaming mode: tracks with hits in the last " << _sliceOverlapTime 
+			     << " ns of a time slice are carried over up to " << _maxCarriedSlices << " times " << std::endl ;
+  }
+
+#if WRITE_PICKED_DEBUG_TRACKS
+  CEDPickingHandler::getInstance().registerFunction( LCIO::TRACK  , &printAndSaveTrack ) ; 
+#endif
 
   CEDPickingHandler::getInstance().registerFunction( LCIO::TRACKERHIT  , &printTrackerHit ) ; 
 
@@ -465,24 +707,42 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
   unsigned t_split      = timer.registerTimer(" split clusters      " ) ;
   unsigned t_finalfit   = timer.registerTimer(" final refit         " ) ;
   unsigned t_merge      = timer.registerTimer(" merge segments      " ) ;
+  unsigned t_states     = timer.registerTimer(" final track states  " ) ;
   unsigned t_pickup     = timer.registerTimer(" pick up Si hits     " ) ;
   
   timer.start() ;
 
+  StageCounters& counters = *_counters ;
+  unsigned c_seeds         = counters.registerCounter(" seed clusters             " ) ;
+  unsigned c_rejSeeds      = counters.registerCounter(" rejected seed clusters    " ) ;
+  unsigned c_rejSeedHits   = counters.registerCounter(" hits in rejected seeds    " ) ;
+  unsigned c_rejSeedLayers = counters.registerCounter(" layers of rejected seeds  " ) ;
+  unsigned c_rejSeedChi2   = counters.registerCounter(" chi2/ndf of rejected seeds" ) ;
+  unsigned c_finalFits     = counters.registerCounter(" final refits              " ) ;
+  unsigned c_reusedFits    = counters.registerCounter(" refits skipped (reused)   " ) ;
+  unsigned c_keptFits      = counters.registerCounter(" refits kept for Si pickup " ) ;
+  unsigned c_kalPeak       = counters.registerCounter(" peak live Kalman tracks   " ) ;
+  unsigned c_kalReleases   = counters.registerCounter(" Kalman budget releases    " ) ;
+
+  KalTrackBudget& kalBudget = *_kalBudget ;
+  kalBudget.newEvent() ;
+
   // set the correct configuration for the tracking system for this event 
   MarlinTrk::TrkSysConfig< MarlinTrk::IMarlinTrkSystem::CFG::useQMS>       mson( _trksystem,  _MSOn ) ;
   MarlinTrk::TrkSysConfig< MarlinTrk::IMarlinTrkSystem::CFG::usedEdx>      elosson( _trksystem,_ElossOn) ;
   MarlinTrk::TrkSysConfig< MarlinTrk::IMarlinTrkSystem::CFG::useSmoothing> smoothon( _trksystem,_SmoothOn) ;
   
 
+  // the per-event buffers are kept by the processor - their memory is reused in every event
+  ClupaWorkspace& ws = *_workspace ;
+
   // the clupa wrapper hits that hold pointers to LCIO hits plus some additional parameters
   // create them in a vector for convenient memeory mgmt 
-  std::vector<ClupaHit> clupaHits ;
+  std::vector<ClupaHit>& clupaHits = ws.clupaHits ;
   
-  // on top of the clupahits we need the tiny wrappers for clustering - they are created on the heap
-  // and we put them in a vector of pointers that takes ownership (i.e. deletes them at the end)
-  HitVec nncluHits ;        
-  nncluHits.setOwner( true ) ;
+  // on top of the clupahits we need the tiny wrappers for clustering - they are created in the 
+  // workspace's hit pool and we put pointers to them in a vector 
+  HitVec& nncluHits = ws.nncluHits ;        
 
 
   // this is the final list of cluster tracks
@@ -493,22 +753,31 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
   converter.UsePropagate  = true ;
   converter.CaloFaceBarrelID  = _caloFaceBarrelID ;
   converter.CaloFaceEndcapID  = _caloFaceEndcapID ;
+  converter.ExportDChi2  = _exportDebugExtensions ;
 
-  // --------  get the TPC geometry information from the DD4hep model
+  // the converter for the debug collections computes only the requested track states
+  LCIOTrackConverter debugConverter( converter ) ;
+  debugConverter.TrackStates = _debugTrackStates ;
 
-  dd4hep::Detector& lcdd = dd4hep::Detector::getInstance();
-  dd4hep::DetElement tpcDE = lcdd.detector("TPC") ;
-  _tpc = tpcDE.extension<dd4hep::rec::FixedPadSizeTPCData>() ;
-
-  double bfieldV[3] ;
-  lcdd.field().magneticField( { 0., 0., 0. }  , bfieldV  ) ;
-  _bfield = bfieldV[2]/dd4hep::tesla ;
+  if( _deferTrackStates ){ 
+    // track segments only get the track states needed for merging - the IP state is extrapolated
+    // the remaining states are computed for the final tracks in outCol
+    converter.UsePropagate  = false ;
+    converter.TrackStates = LCIOTrackConverter::AtIP | LCIOTrackConverter::AtFirstHit | LCIOTrackConverter::AtLastHit ;
+  }
 
   // fixme:  currently LCTPC not supported until DDRec data exists ...
-  static const unsigned int maxTPCLayers = _tpc->maxRow ;
+  const unsigned int maxTPCLayers = _tpc->maxRow ;
   
   double driftLength = _tpc->driftLength / dd4hep::mm ;
   ZIndex zIndex( -driftLength , driftLength , _nZBins  ) ; 
+
+  // define an inner cylinder where we exclude hits from re-clustering - the region of the hits is tagged on creation
+  double zMaxInnerHits   = driftLength * _reclusterInnerZFraction ;
+  double rhoMaxInnerHits =  ( _tpc->rMinReadout +  _reclusterInnerRhoFraction * 
+			      ( _tpc->rMaxReadout - _tpc->rMinReadout ) ) /dd4hep::mm ;
+
+  const InnerCylinder innerCylinder( zMaxInnerHits , rhoMaxInnerHits ) ;
   
 
   LCCollection* col = 0 ;
@@ -519,63 +788,122 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
     
     streamlog_out( WARNING ) <<  " input collection not in event : " << _colName << "   - nothing to do  !!! " << std::endl ;  
     
+    // streaming mode: the next slice does not continue this one - the carried candidates are lost
+    if( _carryOver ){
+
+      unsigned nLost = _carryOver->reset() ;
+
+      _counters->add( _counters->registerCounter(" carried candidates lost   " ) , nLost ) ;
+
+      if( nLost )
+	streamlog_out( WARNING ) << "  streaming mode: " << nLost << " carried track candidates lost " << std::endl ;
+    }
+
     return ;
   } 
+
+  if( _snapshot ) 
+    _snapshot->write( evt->getRunNumber() , evt->getEventNumber() , col ) ;
+
+  // streaming mode: the copies of the hits carried over from the previous time slice are added to the event
+  LCCollectionVec* carriedCol = 0 ;
+
+  if( _carryOver ){
+    carriedCol = _carryOver->takeHits() ;
+    evt->addCollection( carriedCol , _carriedHitsColName ) ;
+  }
       
   //===============================================================================================
   //   create clupa and clustering hits for every lcio hit
   //===============================================================================================
   
-  //  CellIDDecoder<TrackerHit> idDec( col ) ;
-  
+  // the layer is decoded with a precomputed mask and shift 
+  const CellIDField layerField( LCTrackerCellID::encoding_string() , LCTrackerCellID::layer() ) ;
+
+  // access the hits directly in the collection's vector 
+  LCCollectionVec* colVec = dynamic_cast<LCCollectionVec*>( col ) ;
+
   int nHit = col->getNumberOfElements() ;
+  int nCarried = ( carriedCol ?  carriedCol->getNumberOfElements()  :  0 ) ;
   
-  clupaHits.resize( nHit ) ;       // creates clupa hits (w/ default c'tor)
-  nncluHits.reserve( nHit ) ;
+  ws.reset( nHit + nCarried , maxTPCLayers ) ;  // creates clupa hits (w/ default c'tor)
 
+  std::vector<Hit*> carriedHits( nCarried , (Hit*) 0 ) ;
 
-  streamlog_out( DEBUG1 ) << "  create clupatra TPC hits, n = " << nHit << std::endl ;
+  streamlog_out( DEBUG1 ) << "  create clupatra TPC hits, n = " << nHit << " + " << nCarried << " carried over " << std::endl ;
   
-  for(int i=0 ; i < nHit ; ++i ) {
+  for(int i=0 ; i < nHit + nCarried ; ++i ) {
     
-    //------
-    
-    TrackerHit* th = (TrackerHit*) col->getElementAt(i) ;
-    if ( fabs(th->getPosition()[2]) > driftLength ) continue;
+    TrackerHit* th = ( i < nHit  ?  static_cast<TrackerHit*>( colVec ?  (*colVec)[i]  :  col->getElementAt(i) ) 
+		       :  static_cast<TrackerHit*>( (*carriedCol)[ i - nHit ] ) ) ;
+
+    // hits in the overlap with the previous time slice have been processed there
+    if( i < nHit && _carryOver && _carryOver->seen( th ) ) continue ;
+
+    const double* p = th->getPosition() ;
+
+    if ( std::abs( p[2] ) > driftLength ) continue;
 
     ClupaHit* ch  = & clupaHits[i] ; 
     
-    Hit* gh =  new Hit( ch ) ;
-    
-    nncluHits.push_back( gh ) ;
-    
-    //-------
-    th->ext<GHit>() = gh ;  // assign the clupa hit to the LCIO hit for memory mgmt
-    
     ch->lcioHit = th ; 
+    ch->pos     = dd4hep::rec::Vector3D( p ) ;
+    ch->layer   = layerField( th ) ;
+    ch->zIndex  = zIndex.index( p[2] ) ;
+    ch->region  = innerCylinder.region( p ) ;
     
-    ch->pos = dd4hep::rec::Vector3D(  th->getPosition() ) ;
-    
-    //  int padIndex = padLayout.getNearestPad( ch->pos.rho() , ch->pos.phi() ) ;
-    //    ch->layer = padLayout.getRowNumber( padIndex ) ;
-    ch->layer = ILD_cellID( th )[ LCTrackerCellID::layer() ] ;
- 
-    streamlog_out( DEBUG ) << "  ch->layer = idDec( th )[ LCTrackerCellID::layer() ] = " <<  ch->layer << " - CellID0 " << th->getCellID0() << std::endl ;
+    ws.hitPool.push_back( Hit( ch ) ) ;
+    nncluHits.push_back( &ws.hitPool.back() ) ;
 
-    ch->zIndex = zIndex( th ) ;
-    
-    //ch->phiIndex = ....
-    
+    if( i >= nHit ) 
+      carriedHits[ i - nHit ] = &ws.hitPool.back() ;
   } 
 
   //--------------------------------------------------------------------------------------------------------- 
   
-  std::sort( nncluHits.begin(), nncluHits.end() , ZSort() ) ;
+  // O(N) radix sort in z - the hits are then distributed to the layers in this order, 
+  // i.e. the hits in every layer are sorted in z as well
+  ws.sortHitsInZ() ;
   
   //--------------------------------------------------------------------------------------------------------- 
   
-  HitListVector hitsInLayer( maxTPCLayers ) ;
-  addToHitListVector(  nncluHits.begin(), nncluHits.end() , hitsInLayer  ) ;
+  // restore the track candidates carried over from the previous time slice - their hits are used
+  Clusterer::cluster_list carriedClu ;    
+  carriedClu.setOwner() ;
+
+  for( unsigned i=0, N=( _carryOver ?  _carryOver->nCandidates()  :  0 ) ; i<N ; ++i ){
+
+    const std::vector<int>& cand = _carryOver->candidate( i ) ;
+
+    CluTrack* clu = new CluTrack ;
+
+    for( unsigned j=0, M=cand.size() ; j<M ; ++j )
+      if( carriedHits[ cand[j] ] ) 
+	clu->addElement( carriedHits[ cand[j] ] ) ;
+
+    if( clu->size() < 3 ){  // cannot be fitted
+      clu->freeElements() ;
+      delete clu ;
+      continue ;
+    }
+
+    carriedClu.push_back( clu ) ;
+  }
+
+  //--------------------------------------------------------------------------------------------------------- 
+  
+  HitListVector& hitsInLayer = ws.hitsInLayer ;
+
+  if( carriedClu.empty() ){
+
+    addToHitListVector(  nncluHits.begin(), nncluHits.end() , hitsInLayer  ) ;
+
+  } else {
+
+    for( HitVec::iterator it = nncluHits.begin(), end = nncluHits.end() ; it != end ; ++it )
+      if( (*it)->second == 0 ) 
+	hitsInLayer[ (*it)->first->layer ].push_back( *it ) ;
+  }
   
   streamlog_out( DEBUG2 ) << "  added  " <<  nncluHits.size()  << "  tp hitsInLayer - > size " <<  hitsInLayer.size() << std::endl ;
 
@@ -589,7 +917,6 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
   const bool writeCluTrackSegments   = _createDebugCollections ;
   const bool writeLeftoverClusters   = _createDebugCollections ;
   const bool writeQualityTracks      = _createDebugCollections ;
-  const bool writeDebugTracks      =  WRITE_PICKED_DEBUG_TRACKS ;
   
   static const bool copyTrackSegments = false ;
   
@@ -605,9 +932,9 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
   //LCCollectionVec* fairCol  = ( writeQualityTracks ?  newTrkCol( "ClupatraFairQualityTracks" , evt ,true )  :   0   )  ; 
   LCCollectionVec* poorCol  = ( writeQualityTracks ?  newTrkCol( "ClupatraPoorQualityTracks" , evt , true )  :   0   )  ; 
 
-  LCCollectionVec* debugCol=  ( writeDebugTracks ?  newTrkCol( "ClupatraDebugTracks" , evt , false )  :   0   )  ; 
-  if( WRITE_PICKED_DEBUG_TRACKS ) 
-    DebugTracks::setCol( debugCol , this ) ; 
+#if WRITE_PICKED_DEBUG_TRACKS
+  DebugTracks::setCol( newTrkCol( "ClupatraDebugTracks" , evt , false ) , this ) ; 
+#endif
 
   LCCollectionVec* outerCol  = ( _createDebugCollections ?  newTrkCol( "ClupatraOuterSegments" , evt ,true )  :   0   )  ; 
   LCCollectionVec* innerCol  = ( _createDebugCollections ?  newTrkCol( "ClupatraInnerSegments" , evt ,true )  :   0   )  ; 
@@ -635,101 +962,50 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
   
   int outerRow = 0 ;
   
-  nnclu::PtrVector<MarlinTrk::IMarlinTrack> seedTrks ;
-  seedTrks.setOwner() ; // memory mgmt - will delete MarlinTrks at the end
-  
-  IMarlinTrkFitter fitter( _trksystem ) ;
+  IMarlinTrkFitter fitter( _trksystem , DBL_MAX , _fitPrefixHits , _minFitHitFraction ) ;
+
+  // fit, extend and release the Kalman tracks of the carried candidates and of the split leftover clusters
+  ClusterExtender extend( fitter , hitsInLayer , zIndex , _dChi2Max, _chi2Cut , _maxStep , &kalBudget , _reuseSeedState ) ;
+
+  //-----  streaming mode: first extend the candidates carried over from the previous time slice 
+  if( _carryOver ){
+
+    counters.add( counters.registerCounter(" carried track candidates  " ) , carriedClu.size() ) ;
+
+    extend( carriedClu ) ;
+
+    cluList.merge( carriedClu ) ;
+  }
 
 
   streamlog_out( DEBUG5 ) << "===============================================================================================\n"
-			  << "   first step of Clupatra algorithm: find seeds with NN-clustering  in " <<  _nLoop << " loops - max dist = " << _distCut <<" \n"
+			  << "   first step of Clupatra algorithm: find seeds with " << _seedingEngine << "  in " <<  _nLoop << " loops - max dist = " << _distCut <<" \n"
 			  << "===============================================================================================\n"  ;
   
   // ---- introduce a loop over increasing distance cuts for finding the tracks seeds
   //      -> should fix (some of) the problems seen @ 3 TeV with extremely boosted jets
   //
-  double dcut =  _distCut / _nLoop ;
-  for(int nloop=1 ; nloop <= _nLoop ; ++nloop){ 
+  // the Hough and CA seeding do not increase the distance cut - one loop over the pad row windows
+  const int nSeedLoops = ( _houghSeeder || _caSeeder  ?  1  :  _nLoop ) ;
 
-    HitDistance dist( nloop * dcut , _cosAlphaCut ) ;
+  double dcut =  _distCut / _nLoop ;
+  for(int nloop=1 ; nloop <= nSeedLoops ; ++nloop){ 
 
     outerRow = maxTPCLayers - 1 ;
     
     while( outerRow >= _minCluSize ) { //_padRowRange * .5 ) {
 
-      HitVec hits ;
-      hits.reserve( nHit ) ;
-      
-      // add all hits in pad row range to hits
-      for(int iRow = outerRow ; iRow > ( outerRow - _padRowRange) ; --iRow ) {
-
-	if( iRow > -1 ) {
-
-	  streamlog_out( DEBUG0 ) << "  copy " <<  hitsInLayer[ iRow ].size() << " hits for row " << iRow << std::endl ;
-
-	  std::copy( hitsInLayer[ iRow ].begin() , hitsInLayer[ iRow ].end() , std::back_inserter( hits )  ) ;
-	}
-      }
-      
-      //-----  cluster in given pad row range  -----------------------------
+      //-----  find seed clusters in the given pad row range  -----------------------------
       Clusterer::cluster_list sclu ;    
       sclu.setOwner() ;  
-    
-      streamlog_out( DEBUG2 ) << "   call cluster_sorted with " <<  hits.size() << " hits " << std::endl ;
-
-      nncl.cluster_sorted( hits.begin(), hits.end() , std::back_inserter( sclu ), dist , _minCluSize ) ;
-    
-      const static int merge_seeds = true ; 
-
-      if( merge_seeds ) { //-----------------------------------------------------------------------
-	
-	// sometimes we have split seed clusters as one link is just above the cut
-	// -> recluster in all hits of small clusters with 1.2 * cut 
-	float _smallClusterPadRowFraction = 0.9  ;
-	float _cutIncrease = 1.2 ;
-	// fixme: could make parameters ....
-
-	HitVec seedhits ;
-	Clusterer::cluster_list smallclu ; 
-	smallclu.setOwner() ;      
-	split_list( sclu, std::back_inserter(smallclu),  ClusterSize(  int( _padRowRange * _smallClusterPadRowFraction) ) ) ; 
-	for( Clusterer::cluster_list::iterator sci=smallclu.begin(), end= smallclu.end() ; sci!=end; ++sci ){
-	  for( Clusterer::cluster_type::iterator ci=(*sci)->begin(), end1= (*sci)->end() ; ci!=end1;++ci ){
-	    seedhits.push_back( *ci ) ; 
-	  }
-	}
-	// free hits from bad clusters 
-	std::for_each( smallclu.begin(), smallclu.end(), std::mem_fun( &CluTrack::freeElements ) ) ;
-	
-	HitDistance distLarge( nloop * dcut * _cutIncrease ) ;
-
-	nncl.cluster_sorted( seedhits.begin(), seedhits.end() , std::back_inserter( sclu ), distLarge , _minCluSize ) ;
-
-      } //------------------------------------------------------------------------------------------
-
-      streamlog_out( DEBUG3 ) << "     found " <<  sclu.size() << "  clusters " << std::endl ;
-
-      // try to split up clusters according to multiplicity
-      int layerWithMultiplicity = _padRowRange - 2  ; // fixme: make parameter 
-      split_multiplicity( sclu , layerWithMultiplicity , 10 ) ;
-
 
-      // remove clusters whith too many duplicate hits per pad row
-      Clusterer::cluster_list bclu ;    // bad clusters  
-      bclu.setOwner() ;      
-      split_list( sclu, std::back_inserter(bclu),  DuplicatePadRows( maxTPCLayers, _duplicatePadRowFraction  ) ) ;
-      // free hits from bad clusters 
-      std::for_each( bclu.begin(), bclu.end(), std::mem_fun( &CluTrack::freeElements ) ) ;
-
-     
-      // ---- now we also need to remove the hits from good cluster seeds from the hitsInLayers:
-      for( Clusterer::cluster_list::iterator sci=sclu.begin(), end= sclu.end() ; sci!=end; ++sci ){
-	for( Clusterer::cluster_type::iterator ci=(*sci)->begin(), end1= (*sci)->end() ; ci!=end1;++ci ){
-	
-	  // this is not cheap ...
-	  hitsInLayer[ (*ci)->first->layer ].remove( *ci )  ; 
-	}
-      }
+      if( _houghSeeder ) 
+	_houghSeeder->findSeeds( hitsInLayer , outerRow , _padRowRange , sclu ) ;
+      else if( _caSeeder ) 
+	_caSeeder->findSeeds( hitsInLayer , outerRow , _padRowRange , sclu ) ;
+      else
+	findSeedClusters( hitsInLayer , ws.windowHits , outerRow , _padRowRange , nloop * dcut , _cosAlphaCut , 
+			  _minCluSize , maxTPCLayers , _duplicatePadRowFraction , sclu ) ;
     
       // now we have 'clean' seed clusters
       // Write debug collection with seed clusters:
@@ -737,7 +1013,7 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
       // The conversion is performed by the STL transform() function, the insertion to the end of the
       // debug track collection is done by creating an STL back_inserter iterator on the LCCollectionVector seedCol
       if( writeSeedCluster ) {
-	std::transform( sclu.begin(), sclu.end(), std::back_inserter( *seedCol ) , converter ) ;
+	std::transform( sclu.begin(), sclu.end(), std::back_inserter( *seedCol ) , debugConverter ) ;
       }
       
       //      std::transform( sclu.begin(), sclu.end(), std::back_inserter( seedTrks) , fitter ) ;
@@ -756,6 +1032,7 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
 	//	streamlog_out( DEBUG4 ) <<  " call fitter for seed cluster with " << (*icv)->size() << " hits " << std::endl ;
 
 	MarlinTrk::IMarlinTrack* mTrk = fitter( *icv ) ;
+	kalBudget.acquire() ;
 
 	nHitsAdded += addHitsAndFilter( *icv , hitsInLayer , _dChi2Max, _chi2Cut , _maxStep , zIndex ) ; 
       
@@ -765,14 +1042,31 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
 	// nHitsAdded += addHitsAndFilter( *icv , hitsInLayer , _dChi2Max, _chi2Cut , _maxStep , zIndex, backward , _trksystem ) ; 
 
 
+	counters.add( c_seeds ) ;
+
 	// drop seed clusters with no hits added - but not in the very forward region...
 	if( nHitsAdded < 1  &&  outerRow >   2*_padRowRange  ){  //FIXME: make parameter ?
 
-	  std::unique_ptr<Track> lcioTrk( converter( *icv ) ) ;
+	  // no track conversion here - just collect some numbers for diagnostics
+	  counters.add( c_rejSeeds ) ;
 
-	  streamlog_out( DEBUG3) << "=============  poor seed cluster - no hits added - started from row " <<  outerRow << "\n"
-				 << *lcioTrk << std::endl ;
-	  
+	  if( _seedDiagnostics ){
+
+	    const CluTrack::summary_type& cs = (*icv)->summary() ;
+
+	    double chi2 = 0. ;
+	    int ndf = 0 ;
+	    IMPL::TrackStateImpl ts ;
+	    mTrk->getTrackState( ts, chi2, ndf ) ;
+
+	    counters.add( c_rejSeedHits   , cs.size ) ;
+	    counters.add( c_rejSeedLayers , cs.maxLayer - cs.minLayer + 1 ) ;
+	    counters.add( c_rejSeedChi2   , ( ndf > 0 ? chi2 / ndf : 0. ) ) ;
+
+	    streamlog_out( DEBUG3) << "=============  poor seed cluster - no hits added - started from row " <<  outerRow 
+				   << " - hits : " << cs.size << " layers : [" << cs.minLayer << "," << cs.maxLayer << "]"
+				   << " chi2 : " << chi2 << " ndf : " << ndf << std::endl ;
+	  }
 	  
 	  for( Clusterer::cluster_type::iterator ci=(*icv)->begin(), end1= (*icv)->end() ; ci!=end1; ++ci ) {
 	    hitsInLayer[ (*ci)->first->layer ].push_back( *ci )   ; 
@@ -789,12 +1083,16 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
 	// }
 
 	if( writeCluTrackSegments )  //  ---- store track segments from the first main step  ----- 
-	  cluCol->addElement(  converter( *icv ) );
+	  cluCol->addElement(  debugConverter( *icv ) );
 	
-	// reset the pointer to the KalTest track - as we are done with this track
-	(*icv)->ext<MarTrk>() = 0 ;
+	// keep the KalTest track for the final refit - or reset the pointer to it, as we are done with this track
+	if( ! _reuseSeedState || ! keepExtensionTrk( *icv , mTrk , &kalBudget ) ){
+
+	  (*icv)->ext<MarTrk>() = 0 ;
 	
-	delete mTrk ;
+	  delete mTrk ;
+	  kalBudget.release() ;
+	}
       } 
 
       // merge the good clusters to final list
@@ -821,10 +1119,6 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
     outerRow = maxTPCLayers - 1 ;
     
     int padRangeRecluster = 50 ; // FIXME: make parameter 
-    // define an inner cylinder where we exclude hits from re-clustering:
-    double zMaxInnerHits   = driftLength * .67 ;   // FIXME: make parameter 
-    double rhoMaxInnerHits =  ( _tpc->rMinReadout +  0.67 * 
-				( _tpc->rMaxReadout - _tpc->rMinReadout ) ) /dd4hep::mm ; // FIXME: make parameter
 
     
     streamlog_out( DEBUG5 ) << "  ===========================================================================\n"
@@ -838,26 +1132,15 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
       Clusterer::cluster_list loclu ; // leftover clusters
       loclu.setOwner() ;
       
-      HitVec hits ;
+      HitVec& hits = ws.windowHits ;
+      hits.clear() ;
       
       int  minRow = ( ( outerRow - padRangeRecluster ) > -1 ?  ( outerRow - padRangeRecluster ) : -1 ) ;
       
-      // add all hits in pad row range to hits
-      for(int iRow = outerRow ; iRow > minRow ; --iRow ) {
-	
-	streamlog_out( DEBUG ) << "      hit candidates in row " << iRow << " : " << hitsInLayer[ iRow ].size() << std::endl ;
-	
-	for( HitList::iterator hlIt=hitsInLayer[ iRow ].begin() , end = hitsInLayer[ iRow ].end() ; hlIt != end ; ++hlIt ) {
-	  streamlog_out( DEBUG ) << "      hit candidate for reclustering " << (*hlIt)->first 
-				 << " ( std::abs( (*hlIt)->first->pos.z() ) > zMaxInnerHits  ||  (*hlIt)->first->pos.rho() >  rhoMaxInnerHits )  " 
-				 <<   ( std::abs( (*hlIt)->first->pos.z() ) > zMaxInnerHits  ||  (*hlIt)->first->pos.rho() >  rhoMaxInnerHits )
-				 << std::endl ;
-	  
-	  if( std::abs( (*hlIt)->first->pos.z() ) > zMaxInnerHits  ||  (*hlIt)->first->pos.rho() >  rhoMaxInnerHits ) {
-	    hits.push_back( *hlIt ) ;
-	  }
-	}
-      }
+      // add all leftover hits in pad row range outside the inner cylinder to hits
+      hits.assign( RegionHitIterator( hitsInLayer , outerRow , minRow , InnerRegion ) , RegionHitIterator() ) ;
+      
+      streamlog_out( DEBUG ) << "      hit candidates for reclustering in rows " << outerRow << " - " << minRow + 1 << " : " << hits.size() << std::endl ;
       
       
       HitDistance distSmall( _distCut ) ; 
@@ -869,7 +1152,7 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
       
       // Write debug collection using STL transform() function on the clusters 
       if( writeLeftoverClusters )
-	std::transform( loclu.begin(), loclu.end(), std::back_inserter( *locCol ) , converter ) ;
+	std::transform( loclu.begin(), loclu.end(), std::back_inserter( *locCol ) , debugConverter ) ;
       
       
       // timer.time( t_recluster ) ;
@@ -897,98 +1180,34 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
 	}
 	
 	
-	if( float( mult[5]) / mult[0]  >= _minLayerFractionWithMultiplicity &&  mult[5] >  _minLayerNumberWithMultiplicity ) {
+	// split the cluster according to the highest hit multiplicity found in enough layers
+	int nSplit = 0 ;
+	for( int m=5 ; m>0 && nSplit == 0 ; --m ){
+	  if( float( mult[m]) / mult[0]  >= _minLayerFractionWithMultiplicity &&  mult[m] >  _minLayerNumberWithMultiplicity ) 
+	    nSplit = m ;
+	}
+	
+	if( nSplit > 1 ) {
 	  
 	  Clusterer::cluster_list reclu ; // reclustered leftover clusters
 	  reclu.setOwner() ;
 	  
-	  create_n_clusters( *clu , reclu , 5 ) ;
-	  
-	  std::transform( reclu.begin(), reclu.end(), std::back_inserter( seedTrks) , fitter ) ;
-	  
-	  for( Clusterer::cluster_list::iterator ir= reclu.begin(), end1= reclu.end() ; ir != end1 ; ++ir ){
-	    
-	    streamlog_out( DEBUG5 ) << " extending mult-5 clustre  of length " << (*ir)->size() << std::endl ;
-	    
-	    addHitsAndFilter( *ir , hitsInLayer , _dChi2Max, _chi2Cut , _maxStep , zIndex) ; 
-	    static const bool backward = true ;
-	    addHitsAndFilter( *ir , hitsInLayer , _dChi2Max, _chi2Cut , _maxStep , zIndex, backward ) ; 
+	  switch( nSplit ){
+	  case 2:  create_two_clusters( *clu , reclu ) ;          break ;
+	  case 3:  create_three_clusters( *clu , reclu ) ;        break ;
+	  default: create_n_clusters( *clu , reclu , nSplit ) ;  break ;
 	  }
 	  
-	  cluList.merge( reclu ) ;
-	} 
-      
-	else if( float( mult[4]) / mult[0]  >= _minLayerFractionWithMultiplicity &&  mult[4] >  _minLayerNumberWithMultiplicity ) {
-	
-	  Clusterer::cluster_list reclu ; // reclustered leftover clusters
-	  reclu.setOwner() ;
-	
-	  create_n_clusters( *clu , reclu , 4 ) ;
-	
-	  std::transform( reclu.begin(), reclu.end(), std::back_inserter( seedTrks) , fitter ) ;
-	
-	  for( Clusterer::cluster_list::iterator ir= reclu.begin(), end1= reclu.end() ; ir != end1 ; ++ir ){
-	  
-	    streamlog_out( DEBUG5 ) << " extending mult-4 clustre  of length " << (*ir)->size() << std::endl ;
-	  
-	    addHitsAndFilter( *ir , hitsInLayer , _dChi2Max, _chi2Cut , _maxStep , zIndex) ; 
-	    static const bool backward = true ;
-	    addHitsAndFilter( *ir , hitsInLayer , _dChi2Max, _chi2Cut , _maxStep , zIndex, backward ) ; 
-	  }
-	
-	  cluList.merge( reclu ) ;
-	} 
-      
-	else if( float( mult[3]) / mult[0]  >= _minLayerFractionWithMultiplicity &&  mult[3] >  _minLayerNumberWithMultiplicity ) {
-	
-	  Clusterer::cluster_list reclu ; // reclustered leftover clusters
-	  reclu.setOwner() ;
-	
-	  create_three_clusters( *clu , reclu ) ;
-	
-	  std::transform( reclu.begin(), reclu.end(), std::back_inserter( seedTrks) , fitter ) ;
-	
-	  for( Clusterer::cluster_list::iterator ir= reclu.begin(), end1= reclu.end() ; ir != end1 ; ++ir ){
+	  streamlog_out( DEBUG5 ) << " extending " << reclu.size() << " sub-clusters of a multiplicity-" << nSplit << " cluster " << std::endl ;
 	  
-	    streamlog_out( DEBUG5 ) << " extending triplet clustre  of length " << (*ir)->size() << std::endl ;
+	  extend( reclu ) ;
 	  
-	    addHitsAndFilter( *ir , hitsInLayer , _dChi2Max, _chi2Cut , _maxStep , zIndex) ; 
-	    static const bool backward = true ;
-	    addHitsAndFilter( *ir , hitsInLayer , _dChi2Max, _chi2Cut , _maxStep , zIndex, backward ) ; 
-	  }
-	
 	  cluList.merge( reclu ) ;
 	} 
-      
-	else if( float( mult[2]) / mult[0]  >= _minLayerFractionWithMultiplicity &&  mult[2] >  _minLayerNumberWithMultiplicity ) {
-	
-	  Clusterer::cluster_list reclu ; // reclustered leftover clusters
-	  reclu.setOwner() ;
-	
-	  create_two_clusters( *clu , reclu ) ;
-	
-	  std::transform( reclu.begin(), reclu.end(), std::back_inserter( seedTrks) , fitter ) ;
-	
-	  for( Clusterer::cluster_list::iterator ir= reclu.begin(), end1= reclu.end() ; ir != end1 ; ++ir ){
-	  
-	    streamlog_out( DEBUG5 ) << " extending doublet clustre  of length " << (*ir)->size() << std::endl ;
-	  
-	    addHitsAndFilter( *ir , hitsInLayer , _dChi2Max, _chi2Cut , _maxStep , zIndex) ; 
-	    static const bool backward = true ;
-	    addHitsAndFilter( *ir , hitsInLayer , _dChi2Max, _chi2Cut , _maxStep , zIndex, backward ) ; 
-	  } 
-	
-	  cluList.merge( reclu ) ;
-	
-	}
-	else if( float( mult[1]) / mult[0]  >= _minLayerFractionWithMultiplicity &&  mult[1] >  _minLayerNumberWithMultiplicity ) {    
-	
-	
-	  seedTrks.push_back( fitter( *it )  );
+
+	else if( nSplit == 1 ) {    
 	
-	  addHitsAndFilter( *it , hitsInLayer , _dChi2Max, _chi2Cut , _maxStep , zIndex) ; 
-	  static const bool backward = true ;
-	  addHitsAndFilter( *it , hitsInLayer , _dChi2Max, _chi2Cut , _maxStep , zIndex, backward ) ; 
+	  extend( clu ) ;
 	
 	  cluList.push_back( *it ) ;
 	
@@ -1038,21 +1257,60 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
 
   //---- refit cluster tracks individually to save memory ( KalTest tracks have ~1MByte each)
 
-  IMarlinTrkFitter fit(_trksystem,  _dChi2Max) ; // fixme: do we need a different chi2 max here ????
+  IMarlinTrkFitter fit(_trksystem,  _dChi2Max, _fitPrefixHits , _minFitHitFraction ) ; // fixme: do we need a different chi2 max here ????
+
+  // optionally keep some of the Kalman tracks for the pick up of silicon hits - within the memory budget
+  unsigned maxFinalFitTrks = ( _pickUpSiHits  ?  unsigned( _keepFinalFitMB / _kalTrackSizeMB )  :  0 ) ;
+
+  nnclu::PtrVector<MarlinTrk::IMarlinTrack> finalFitTrks ;
+  finalFitTrks.setOwner() ; // memory mgmt - will delete MarlinTrks at the end
 
   for( Clusterer::cluster_list::iterator icv = cluList.begin() , end = cluList.end() ; icv != end ; ++ icv ) {
 
+    // the Kalman track kept after the extension replaces the refit, if the cluster has not changed since (ReuseSeedState)
+    MarlinTrk::IMarlinTrack* trk = takeExtensionTrk( *icv , fit ) ;
+
     if( (*icv)->empty() ) 
       continue ;
 
-    MarlinTrk::IMarlinTrack* trk = fit( *icv ) ;
+    counters.add( c_finalFits ) ;
+
+    if( trk ){
+
+      counters.add( c_reusedFits ) ;
+
+    } else {
+
+      trk = fit( *icv ) ;
+      kalBudget.acquire() ;
+    }
+
     trk->smooth() ;
     Track* lcioTrk = converter( *icv ) ; 
     tsCol->push_back(  lcioTrk ) ;
-    lcioTrk->ext<MarTrk>() = 0 ;
-    delete trk ;
+
+    // leave room for one track in the later stages
+    bool keep = ( finalFitTrks.size() < maxFinalFitTrks ) ;
+
+    if( keep && kalBudget.available() < 1 ){
+      kalBudget.countRelease() ;
+      keep = false ;
+    }
+
+    if( keep ){
+
+      finalFitTrks.push_back( trk ) ;  // the converter has attached the MarlinTrk to the lcio track
+
+    } else {
+
+      lcioTrk->ext<MarTrk>() = 0 ;
+      delete trk ;
+      kalBudget.release() ;
+    }
   }
-  
+
+  counters.add( c_keptFits , finalFitTrks.size() ) ;
+
   timer.time( t_finalfit) ;
   
   //===============================================================================================
@@ -1169,7 +1427,9 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
 	  //	std::copy( trk->getTrackerHits().begin() , trk->getTrackerHits().end() , std::back_inserter( hits ) ) ;
 
 	  for( lcio::TrackerHitVec::const_iterator it1 = trk->getTrackerHits().begin() , END =  trk->getTrackerHits().end() ; it1 != END ; ++it1 ){
-	    hits.addElement( (*it1)->ext<GHit>() )  ;
+	    Hit* h = ws.hit( *it1 ) ;
+	    if( h ) 
+	      hits.addElement( h )  ;
 	  }
 
 	  // flag the segments so they can be ignored for final list 
@@ -1191,11 +1451,13 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
 	// // ??? 
       
 	MarlinTrk::IMarlinTrack* mTrk = fit( &hits ) ;
+	kalBudget.acquire() ;
 	mTrk->smooth() ;
 	Track* track = converter( &hits ) ; 
 	tsCol->push_back(  track ) ;
 	track->ext<MarTrk>() = 0 ;
 	delete mTrk ;
+	kalBudget.release() ;
 	computeTrackInfo( track ) ;    
 
 	streamlog_out( DEBUG4 ) << "   ******  created new track : " << " : " << lcshort( (Track*) track )  << std::endl ;
@@ -1222,6 +1484,8 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
     TrackClusterer::element_vector curSegVec ;
     curSegVec.setOwner() ;
     curSegVec.reserve( nMax  ) ;
+    ws.trackInfos.clear() ;
+    ws.trackInfos.reserve( nMax ) ;
     TrackClusterer::cluster_vector curSegCluVec ;
     curSegCluVec.setOwner() ;
 
@@ -1243,7 +1507,12 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
       
       if( !isCompleteTrack ){ 
 	
-	curSegVec.push_back(  trkMakeElement( trk )  ) ; 
+	// copy the track info into the workspace's side table - the merge predicate only looks at that 
+	TrackClusterer::element_type* e = trkMakeElement( trk ) ;
+	e->Index0 = ws.trackInfos.size() ;
+	ws.trackInfos.push_back( ti ? *ti : TrackInfoStruct() ) ;
+
+	curSegVec.push_back( e ) ; 
 	
 	if( writeCluTrackSegments )  curSegCol->addElement( trk ) ;
 	  
@@ -1268,7 +1537,7 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
     //======================================================================================================
 
 
-    TrackCircleDistance trkMerge( 0.1 ) ; 
+    TrackCircleDistance trkMerge( 0.1 , &ws.trackInfos ) ; 
 
     nntrkclu.cluster( curSegVec.begin() , curSegVec.end() , std::back_inserter( curSegCluVec ), trkMerge , 2  ) ;
 
@@ -1337,7 +1606,9 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
 	if( ts ) trk->addTrackState( new TrackStateImpl( *ts )  ) ;
 	
 	
-	trk->ext<MarTrk>() = firstTrk->ext<MarTrk>() ;
+	// the Kalman track of the first segment only has the hits and the chi2 of that segment: the pick up 
+	// starts from the track state at the IP instead
+	trk->ext<MarTrk>() = 0 ;
 	
 	int hitsInFit  =  firstTrk->getSubdetectorHitNumbers()[ 2 * ILDDetID::TPC - 1 ] ;
 	trk->setChi2(     firstTrk->getChi2()     ) ;
@@ -1430,8 +1701,35 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
     }
     
   }
+  //===============================================================================================
+  //  streaming mode: tracks that can still gain hits are carried over to the next time slice
+  //===============================================================================================
+
+  if( _carryOver ){
+
+    unsigned nDeferred = _carryOver->endSlice( col , nncluHits , outCol , ( copyTrackSegments ?  0  :  tsCol ) ) ;
+
+    counters.add( counters.registerCounter(" tracks deferred to next slice" ) , nDeferred ) ;
+
+    streamlog_out( DEBUG4 ) << "  streaming mode: " << nDeferred << " tracks carried over to the next time slice " << std::endl ;
+  }
+
   timer.time( t_merge ) ;  
 
+  //===============================================================================================
+  //  compute the remaining track states only for the final tracks
+  //===============================================================================================
+
+  if( _deferTrackStates ){
+
+    for(  LCIterator<TrackImpl> it( outCol ) ;  TrackImpl* trk = it.next()  ; ) {
+
+      converter.addTrackStates( trk , LCIOTrackConverter::AtIP | LCIOTrackConverter::AtCalorimeter , _trksystem , _bfield ) ;
+    }
+  }
+
+  timer.time( t_states ) ;  
+
 
 
   //===============================================================================================
@@ -1501,6 +1799,22 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
   }
   //---------------------------------------------------------------------------------------------------------
 
+  // the kept Kalman tracks are not needed anymore - make sure no pointers to them are left
+  if( ! finalFitTrks.empty() ){
+    
+    for(  LCIterator<TrackImpl> it( outCol ) ;  TrackImpl* trk = it.next()  ; ) 
+      trk->ext<MarTrk>() = 0 ;
+
+    for(  LCIterator<TrackImpl> it( tsCol ) ;  TrackImpl* trk = it.next()  ; ) 
+      trk->ext<MarTrk>() = 0 ;
+
+    for( unsigned i=0, N=finalFitTrks.size() ; i<N ; ++i )
+      delete finalFitTrks[i] ;
+
+    kalBudget.release( finalFitTrks.size() ) ;
+    finalFitTrks.clear() ;
+  }
+
   timer.time( t_pickup ) ;  
 
   
@@ -1556,6 +1870,9 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
 
   streamlog_out( DEBUG9 )  <<  timer.toString () << std::endl ;
 
+  counters.add( c_kalPeak     , kalBudget.peak() ) ;
+  counters.add( c_kalReleases , kalBudget.nReleases() ) ;
+
   _nEvt ++ ;
 
 
@@ -1569,283 +1886,389 @@ void ClupatraProcessor::processEvent( LCEvent * evt ) {
 }
 
 
-/*************************************************************************************************/
-void ClupatraProcessor::pickUpSiTrackerHits( EVENT::LCCollection* trackCol , LCEvent* evt) {
-  
-  /*************************************************************************************************/
-  
-  streamlog_out( DEBUG3  ) << " ************ pickUpSiTrackerHits() called - nTracks : " << trackCol->getNumberOfElements() <<std::endl ;
-  
-  std::map< int , std::list<TrackerHit*> > hLMap ;
-  
-  UTIL::BitField64 encoder( LCTrackerCellID::encoding_string() ) ; 
-  
+//----------------------------------------------------------------
+/** result of the search for silicon hits for one track in pickUpSiTrackerHits() */
+struct SiPickUp{
+  MarlinTrk::IMarlinTrack* mTrk = 0 ;                    // the Kalman track used for the pick up 
+  std::unique_ptr<MarlinTrk::IMarlinTrack> tmpTrk{} ;     // owns mTrk if it is a temporary track
+  std::vector<int> hits{} ;     // indices in the SiHitIndex
+  double initial_chi2 = 0. ;
+  int    initial_ndf  = 0 ;
+  unsigned nPropagated = 0 ;   // number of layers the track was propagated to
+  unsigned nSkipped    = 0 ;   // number of layers skipped by the early termination
+};
 
-  if(  parameterSet( "SITHitCollection" ) ) {
-    
-    LCIterator<TrackerHit> it( evt, _sitColName ) ;
-    
-    streamlog_out( DEBUG2  ) << " --  pickUpSiTrackerHits - read SIT hits from collection " <<  _sitColName << "  with size = " << it.size() << "\n" ;
+/** the silicon layers for findSiHits() - VXD layers first, then SIT layers - and the early termination policy */
+struct SiLayerWalk{
+  int nVXDLayers = 0 ;
+  int nSITLayers = 0 ;
+  std::vector<double> rLayer{} ;        // radius of the sensitive layer [mm]
+  std::vector<double> zHalfLayer{} ;    // half length of the sensitive layer [mm]
+  int  maxMissedLayers = 0 ;            // stop after this many consecutive layers w/o hit (0: no limit)
+  bool checkAcceptance = false ;        // skip layers that the helix does not reach within their half length
+  double zTolerance = 0. ;              // tolerance added to the half length [mm]
+};
 
-    while( TrackerHit* hit = it.next()  ){
+/** The Kalman track of the final refit kept with the lcio track (MarTrk), if it can be used for the pick up, i.e. 
+ *  if its last filtered state is at the innermost hit (within rhoTolerance) - otherwise 0.
+ */
+MarlinTrk::IMarlinTrack* keptMarlinTrk( TrackImpl* trk, double rhoTolerance ){
 
-      streamlog_out( DEBUG0  ) << "     adding SIT space point hit to map : " << hit << std::endl ;
+  MarlinTrk::IMarlinTrack* mTrk = trk->ext<MarTrk>() ;
 
-      hLMap[ hit->getCellID0() ].push_back(  hit ) ;
-    }    
-  }
-  if(  parameterSet( "VXDHitCollection" ) ) {
-    
-    LCIterator<TrackerHit> it( evt, _vxdColName ) ;
-    while( TrackerHit* hit = it.next()  ){
-      
-      streamlog_out( DEBUG0  ) << "     adding VXD point hit to map : " << hit << std::endl ;
+  const EVENT::TrackState* tsFH = trk->getTrackState( lcio::TrackState::AtFirstHit ) ; 
 
-      hLMap[ hit->getCellID0() ].push_back(  hit ) ;
-    }    
-  }
+  if( mTrk == 0 || tsFH == 0 ) 
+    return 0 ;
 
+  IMPL::TrackStateImpl ts ;
+  double chi2 ; int ndf ;
+  
+  if( mTrk->getTrackState( ts, chi2, ndf ) != MarlinTrk::IMarlinTrack::success )
+    return 0 ;
 
-  streamlog_out( DEBUG3 ) << "  *****  hitMap size : " <<   hLMap.size() << std::endl ;
+  double rho   = dd4hep::rec::Vector3D( ts.getReferencePoint()   ).rho() ;
+  double rhoFH = dd4hep::rec::Vector3D( tsFH->getReferencePoint() ).rho() ;
+
+  return ( rho < rhoFH + rhoTolerance  ?  mTrk  :  0 ) ;
+}
+
+/** Extrapolate the track to the VXD and SIT layers (outside in) and filter it with the closest unused hit 
+ *  on the intersected sensors - the hit index is not modified. Returns false if the track cannot be extrapolated.
+ *  The Kalman track of the final refit is used if keptTrk is given, otherwise a temporary track is 
+ *  created from the track state at the IP.
+ */
+bool findSiHits( TrackImpl* trk, MarlinTrk::IMarlinTrack* keptTrk, MarlinTrk::IMarlinTrkSystem* trkSys, const SiHitIndex& siHits, 
+		 const SiLayerWalk& walk, double bfield, double dChi2Max, SiPickUp& pu ){
+
+  pu.hits.clear() ;
+  pu.tmpTrk.reset() ;
+  pu.mTrk = 0 ;
+
+  const EVENT::TrackState* ts = trk->getTrackState( lcio::TrackState::AtIP ) ; 
   
-  for( std::map< int , std::list<TrackerHit*> >::iterator it= hLMap.begin(), End = hLMap.end() ; it != End ; ++it ){
-    
-    encoder.setValue( it->first ) ;
-    
-    streamlog_out( DEBUG3 ) << "  *****  sensor: " << encoder.valueString()  << " - nHits: " <<  it->second.size()  << std::endl ;
-    
-  }
+  int nHit = trk->getTrackerHits().size() ;
   
-  int nSITLayers = 0 ;
-  int nVXDLayers = 0 ;
+  if( nHit == 0 || ts ==0 )
+    return false ;
+  
+  MarlinTrk::IMarlinTrack* mTrk = keptTrk ;
 
-  dd4hep::Detector& lcdd = dd4hep::Detector::getInstance();
+  if( mTrk ){
 
-  try{
+    streamlog_out( DEBUG3  )  << "  -- continue from the final fit of the track " << std::endl ;
 
-    dd4hep::DetElement sitDE = lcdd.detector("SIT") ;
-    dd4hep::rec::ZPlanarData* sit = sitDE.extension<dd4hep::rec::ZPlanarData>() ;
-    
-    nSITLayers = sit->layers.size() ;
-    
-    dd4hep::DetElement vxdDE = lcdd.detector("VXD") ;
-    dd4hep::rec::ZPlanarData* vxd = vxdDE.extension<dd4hep::rec::ZPlanarData>() ;
-    
-    nVXDLayers = vxd->layers.size() ;
+    // the chi2 of the kept track includes the TPC hits
+    pu.initial_chi2 = 0. ;
+    pu.initial_ndf  = 0 ;
+
+  } else {
+
+    // this code works for plain lcio tracks, i.e. in the case where the corresponding KalTrack
+    // has already been deleted 
     
-  }catch(...){ } // fixme
+    //--------------------------------------------
+    // create a temporary MarlinTrk
+    //--------------------------------------------
+      
+    pu.tmpTrk.reset( trkSys->createTrack() ) ;
+    mTrk = pu.tmpTrk.get() ;
 
+    pu.initial_chi2 = trk->getChi2() ;
+    pu.initial_ndf  = trk->getNdf() ;
+  
+    streamlog_out( DEBUG3  )  << "  -- extrapolate TrackState : " << lcshort( ts )    << std::endl ;
+  
+    //need to add a dummy hit to the track
+    mTrk->addHit(  trk->getTrackerHits()[0] ) ; // fixme: make sure we got the right TPC hit here !??
+  
+    mTrk->initialise( *ts ,  bfield ,  MarlinTrk::IMarlinTrack::backward ) ;
+  }
 
-  int nLayers  = nVXDLayers + nSITLayers  ;
+  UTIL::BitField64 encoder( LCTrackerCellID::encoding_string() ) ; 
 
+  //--------------------------------------------------
+  // get intersection points with SIT and VXD layers 
+  //-------------------------------------------------
 
-  // ============ sort tracks wrt pt (1./omega) ===============
-  LCCollectionVec* tv  = dynamic_cast<LCCollectionVec*>(trackCol) ;
+  int nVXDLayers = walk.nVXDLayers ;
+  int nLayers  = nVXDLayers + walk.nSITLayers  ;
 
-  if( ! tv ) {
-    streamlog_out( ERROR  ) << " *** pickUpSiTrackerHits() :  dynamic_cast<LCCollectionVec*>(trackCol)  failed !! " << std::endl ; 
-    return ; 
-  }
+  double omega = std::abs( ts->getOmega() ) ;
 
-  std::sort( tv->begin() , tv->end() ,  PtSort()  ) ;
-  
-  for(  LCIterator<TrackImpl> it( trackCol ) ;  TrackImpl* trk = it.next()  ; ) 
-    {
-	
+  int nMissed = 0 ;
 
-      double initial_chi2 = 0 ;
-      int    initial_ndf  = 0 ;
-      
-      // ------------------------------------------
-#if 1 // this code works for plain lcio tracks, i.e. in the case where the corresponding KalTrack
-      // has already been deleted 
-      //===========================================================================================
+  for( int lx=nLayers-1 ; lx >=0 ; --lx) {
 
-      //--------------------------------------------
-      // create a temporary MarlinTrk
-      //--------------------------------------------
-      
-      std::unique_ptr<MarlinTrk::IMarlinTrack> mTrk( _trksystem->createTrack()  ) ;
+    int detID = (  lx >= nVXDLayers  ?  ILDDetID::SIT   :  ILDDetID::VXD  ) ;
+    int layer = (  lx >= nVXDLayers  ?  lx - nVXDLayers  :  lx              ) ;
 
-      const EVENT::TrackState* ts = trk->getTrackState( lcio::TrackState::AtIP ) ; 
-      
-      //    const EVENT::TrackState* ts = trk->getClosestTrackState( 0., 0., 0. ) ;
-      //    const IMPL::TrackStateImpl* ts = dynamic_cast<const IMPL::TrackStateImpl*>( trk->getClosestTrackState( 0., 0., 0. ) ) ;
-      //    const IMPL::TrackStateImpl* ts = dynamic_cast<const IMPL::TrackStateImpl*>( trk->getTrackState( EVENT::TrackState::AtOther ) ) ;
-      //  // FIXME:  what do we need here EVENT::TrackState::AtIP  or AtFirstHit ??
-      
-      int nHit = trk->getTrackerHits().size() ;
-      
-      if( nHit == 0 || ts ==0 )
-	continue ;
-      
+    if( walk.maxMissedLayers > 0 && nMissed >= walk.maxMissedLayers ){
 
-      initial_chi2 = trk->getChi2() ;
-      initial_ndf  = trk->getNdf() ;
+      streamlog_out( DEBUG3 ) << " *******  pickUpSiTrackerHits - stop after " << nMissed << " layers without hit " << std::endl ;
 
-      streamlog_out( DEBUG3  )  << "  -- extrapolate TrackState : " << lcshort( ts )    << std::endl ;
-      
-      //need to add a dummy hit to the track
-      mTrk->addHit(  trk->getTrackerHits()[0] ) ; // fixme: make sure we got the right TPC hit here !??
-      
-      
-      mTrk->initialise( *ts ,  _bfield ,  MarlinTrk::IMarlinTrack::backward ) ;
-    
-#else  //===========================================================================================
-      // use the MarlinTrk allready stored with the TPC track
+      pu.nSkipped += lx + 1 ;
+      break ;
+    }
 
+    if( walk.checkAcceptance ){
 
-      MarlinTrk::IMarlinTrack* mTrk = trk->ext<MarTrk>()  ;
- 
-      //      const EVENT::TrackState* ts = trk->getTrackState( lcio::TrackState::AtIP ) ; 
+      // z of the helix (from the IP) at the radius of the layer:  z = z0 + s * tanL,  s = 2/omega * asin( omega * r / 2 ) 
+      double r = walk.rLayer[ lx ] ;
+      bool inAcceptance = ( omega * r < 2. ) ;
 
-      if( mTrk == 0 ){
-	
-	streamlog_out( DEBUG3  )  << "  ------ null pointer in ext<MarTrk> ! ?? ..... " << std::endl ;
-	continue ;
+      if( inAcceptance ){
+	double s = ( omega > 0. ?  2. / omega * std::asin( omega * r / 2. )  :  r ) ;
+	inAcceptance = ( std::abs( ts->getZ0() + s * ts->getTanLambda() ) < walk.zHalfLayer[ lx ] + walk.zTolerance ) ;
       }
-#endif //===========================================================================================
-
-    //--------------------------------------------------
-    // get intersection points with SIT and VXD layers 
-    //-------------------------------------------------
 
-    //    for( int l=nVXDLayers-1 ; l >=0 ; --l) {
+      if( ! inAcceptance ){
 
-    for( int lx=nLayers-1 ; lx >=0 ; --lx) {
+	streamlog_out( DEBUG3 ) << " *******  pickUpSiTrackerHits - track outside acceptance of SIT/VXD layer " << layer << std::endl ;
 
-      int detID = (  lx >= nVXDLayers  ?  ILDDetID::SIT   :  ILDDetID::VXD  ) ;
-      int layer = (  lx >= nVXDLayers  ?  lx - nVXDLayers  :  lx              ) ;
+	// not counted as missed - the track cannot have a hit there
+	++pu.nSkipped ;
+	continue ;
+      }
+    }
 
-      encoder.reset() ;
-      encoder[ LCTrackerCellID::subdet() ] = detID ;
-      encoder[ LCTrackerCellID::layer()  ] = layer ;
-      int layerID = encoder.lowWord() ;  
+    encoder.reset() ;
+    encoder[ LCTrackerCellID::subdet() ] = detID ;
+    encoder[ LCTrackerCellID::layer()  ] = layer ;
+    int layerID = encoder.lowWord() ;  
       
-
-      MarlinTrk::Vector3D point ;
+    MarlinTrk::Vector3D point ;
       
-      int sensorID = -1 ;
+    int sensorID = -1 ;
+
+    int intersects = mTrk->intersectionWithLayer( layerID, point, sensorID, MarlinTrk::IMarlinTrack::modeClosest ) ;
+
+    ++pu.nPropagated ;
 
-      int intersects = mTrk->intersectionWithLayer( layerID, point, sensorID, MarlinTrk::IMarlinTrack::modeClosest ) ;
+    // counts as missed unless a hit is added below
+    ++nMissed ;
       
-      encoder.setValue( sensorID )  ;
+    encoder.setValue( sensorID )  ;
 
-      streamlog_out( DEBUG3 ) << " *******  pickUpSiTrackerHits - intersection with SIT/VXD layer " << layer 
-			      << " intersects:  " << MarlinTrk::errorCode( intersects ) 
-			      << " sensorID: " << encoder.valueString() 
-			      << std::endl ;
+    streamlog_out( DEBUG3 ) << " *******  pickUpSiTrackerHits - intersection with SIT/VXD layer " << layer 
+			    << " intersects:  " << MarlinTrk::errorCode( intersects ) 
+			    << " sensorID: " << encoder.valueString() 
+			    << std::endl ;
       
-      if( intersects == MarlinTrk::IMarlinTrack::success ){
-	
-	std::list<TrackerHit*>& hL = hLMap[ sensorID ] ;
+    if( intersects != MarlinTrk::IMarlinTrack::success )
+      continue ;
 	
-	streamlog_out( DEBUG3 ) << "    **** found candidate hits : " << hL.size()  
-				<< "         for point " << point << std::endl ;
+    streamlog_out( DEBUG3 ) << "    **** found candidate hits : " << siHits.nHits( sensorID )  
+			    << "         for point " << point << std::endl ;
 	
-	double min = 1.e99 ;
-	double maxDist = 1. ; //FIXME: make parameter - what is reasonable here ?
+    double min = 1.e99 ;
+    double maxDist = 1. ; //FIXME: make parameter - what is reasonable here ?
 	 
-	std::list<TrackerHit*>::iterator bestIt ; 
+    int bestIndex = siHits.findClosest( sensorID , point , 
+					( detID == ILDDetID::SIT  ?  SiHitIndex::StripDistance  :  SiHitIndex::Distance3D ) , min ) ;
 
-	if( detID == ILDDetID::SIT ) {
+    if( bestIndex < 0 || min  > maxDist ){
 
-	  bestIt = find_smallest( hL.begin(), hL.end() , StripDistance2<MarlinTrk::Vector3D>( point ) , min ) ;
+      streamlog_out( DEBUG3 ) << " ######### no close by hit found !! " 
+			      << " (bestIndex < 0)" << (bestIndex < 0) 
+			      << " (min  > maxDist)" << (min  > maxDist) 
+			      << std::endl ;
+      continue ; // the number of layers w/o hits is limited by SiMaxMissedLayers
+    }
 
-	} else {
+    TrackerHit* bestHit = siHits.hit( bestIndex ) ;
 
-	  bestIt = find_smallest( hL.begin(), hL.end() , Distance3D2<MarlinTrk::Vector3D>( point ) , min ) ;
-	}
+    double deltaChi ;
 
-	if( bestIt == hL.end() || min  > maxDist ){
+    streamlog_out( DEBUG3 ) << " will add best matching hit : " << bestHit << " with distance : " << min << std::endl ;
 
-	  streamlog_out( DEBUG3 ) << " ######### no close by hit found !! " 
-				  << " (bestIt == hL.end())" << (bestIt == hL.end()) 
-				  << " (min  > maxDist)" << (min  > maxDist) 
-				  << std::endl ;
-	  continue ; // FIXME: need to limit the number of layers w/o hits !!!!!!
-	}
+    int addHit = mTrk->addAndFit( bestHit , deltaChi, dChi2Max ) ;
+	    
+    streamlog_out( DEBUG3 ) << "    ****  best matching hit : " <<  dd4hep::rec::Vector3D( bestHit->getPosition() )
+			    << "         added : " << MarlinTrk::errorCode( addHit )
+			    << "   deltaChi2: " << deltaChi 
+			    << std::endl ;
 
-	double deltaChi ;
+    if( addHit ==  MarlinTrk::IMarlinTrack::success ){
 
-	streamlog_out( DEBUG3 ) << " will add best matching hit : " << *bestIt << " with distance : " << min << std::endl ;
+      pu.hits.push_back( bestIndex ) ;
 
-	int addHit = mTrk->addAndFit( *bestIt , deltaChi, _dChi2Max ) ;
-	    
-	streamlog_out( DEBUG3 ) << "    ****  best matching hit : " <<  dd4hep::rec::Vector3D( (*bestIt)->getPosition() )
-				<< "         added : " << MarlinTrk::errorCode( addHit )
-				<< "   deltaChi2: " << deltaChi 
+      nMissed = 0 ;
+
+      IMPL::TrackStateImpl tsi ;
+      double chi2N; int ndfN ;
+
+      mTrk->getTrackState( tsi , chi2N , ndfN ) ; 
+
+      streamlog_out( DEBUG3  )  << "  -- extrapolate TrackState : " << lcshort( (TrackState*)&tsi )  << "\n" 
+				<< " chi2: " << chi2N
+				<< " ndfN: " << ndfN    
 				<< std::endl ;
+    }
+  }
 
-	if( addHit ==  MarlinTrk::IMarlinTrack::success ){
+  pu.mTrk = mTrk ;
 
+  return true ;
+}
 
-	  trk->addHit( *bestIt ) ;
-	  hL.erase( bestIt ) ;
+/** Add the silicon hits found with findSiHits() to the track and update the track state at the IP */
+void addSiHits( TrackImpl* trk, const SiHitIndex& siHits, SiPickUp& pu ){
 
-	  IMPL::TrackStateImpl tsi ;
-	  double chi2N; int ndfN ;
+  if( ! pu.mTrk ) 
+    return ;
 
-	  mTrk->getTrackState( tsi , chi2N , ndfN ) ; 
+  // nothing to do if no hit was added - the track state at the IP is unchanged
+  if( pu.hits.empty() ){
+    pu.tmpTrk.reset() ;
+    pu.mTrk = 0 ;
+    return ;
+  }
 
-	  streamlog_out( DEBUG3  )  << "  -- extrapolate TrackState : " << lcshort( (TrackState*)&tsi )  << "\n" 
-				    << " chi2: " << chi2N
-				    << " ndfN: " << ndfN    
-				    << std::endl ;
+  for( unsigned i=0, N=pu.hits.size() ; i<N ; ++i )
+    trk->addHit( siHits.hit( pu.hits[i] ) ) ;
 
-	}
+  // -------------------------   update the track state ----------------------
+  // FIXME: should this be done in processEvent()  ?
+  lcio::TrackStateImpl* tsi =  new lcio::TrackStateImpl ;
+  double chi2 ;
+  int ndf  ;
+  const dd4hep::rec::Vector3D ipv( 0.,0.,0. );
+    
+  // get track state at the IP 
+  int ret = pu.mTrk->propagate(   ipv, *tsi, chi2, ndf ) ;
+  //    int ret = mTrk->extrapolate( ipv, *tsi, chi2, ndf ) ;
+    
+  if( ret == MarlinTrk::IMarlinTrack::success ){
+      
+    tsi->setLocation(  lcio::TrackState::AtIP ) ;
 
-      }
-    }
+    // replaces the old state at the IP in place ( kept as the first one )
+    replaceTrackState( trk, tsi ) ;
+
+    trk->setChi2( chi2 + pu.initial_chi2 ) ;
+    trk->setNdf(  ndf  + pu.initial_ndf  ) ;
+
+  } else { 
 
-    // -------------------------   update the track state ----------------------
-    // FIXME: should this be done in processEvent()  ?
-    lcio::TrackStateImpl* tsi =  new lcio::TrackStateImpl ;
-    double chi2 ;
-    int ndf  ;
-    const dd4hep::rec::Vector3D ipv( 0.,0.,0. );
+    delete tsi ;
+  }
+
+  // done with this track
+  pu.tmpTrk.reset() ;
+  pu.mTrk = 0 ;
+}
+
+
+/*************************************************************************************************/
+void ClupatraProcessor::pickUpSiTrackerHits( EVENT::LCCollection* trackCol , LCEvent* evt) {
+  
+  /*************************************************************************************************/
+  
+  streamlog_out( DEBUG3  ) << " ************ pickUpSiTrackerHits() called - nTracks : " << trackCol->getNumberOfElements() <<std::endl ;
+  
+  // flat hit index, sorted by sensor and local coordinate 
+  SiHitIndex siHits ;
+  
+
+  if(  parameterSet( "SITHitCollection" ) ) {
     
+    LCIterator<TrackerHit> it( evt, _sitColName ) ;
     
-    // get track state at the IP 
-    int ret = mTrk->propagate(   ipv, *tsi, chi2, ndf ) ;
-    //    int ret = mTrk->extrapolate( ipv, *tsi, chi2, ndf ) ;
+    streamlog_out( DEBUG2  ) << " --  pickUpSiTrackerHits - read SIT hits from collection " <<  _sitColName << "  with size = " << it.size() << "\n" ;
+
+    while( TrackerHit* hit = it.next()  ){
+
+      streamlog_out( DEBUG0  ) << "     adding SIT space point hit to index : " << hit << std::endl ;
+
+      siHits.add( hit ) ;
+    }    
+  }
+  if(  parameterSet( "VXDHitCollection" ) ) {
     
-    if( ret == MarlinTrk::IMarlinTrack::success ){
-      
-      tsi->setLocation(  lcio::TrackState::AtIP ) ;
+    LCIterator<TrackerHit> it( evt, _vxdColName ) ;
+    while( TrackerHit* hit = it.next()  ){
       
+      streamlog_out( DEBUG0  ) << "     adding VXD point hit to index : " << hit << std::endl ;
 
-      // the track state at the IP needs to be the first one
-      //  -> we have to copy the whole vector, and then add 
-      //     all track states except the old one at the IP ....
-      TrackStateVec tsv  = trk->trackStates() ;
-      trk->trackStates().clear() ;
-      
-      trk->addTrackState( tsi ) ;
-      
-      for( int i=0, N=tsv.size() ; i<N ; ++i ){
+      siHits.add( hit ) ;
+    }    
+  }
 
-	if( tsv[i]->getLocation() == lcio::TrackState::AtIP ) {
+  siHits.sort() ;
 
-	  delete  tsv[i] ;
+  streamlog_out( DEBUG3 ) << "  *****  number of sensors with hits : " <<   siHits.nSensors() << std::endl ;
+  
 
-	}else{
+  SiLayerWalk walk ;
+  walk.nSITLayers = _nSITLayers ;
+  walk.nVXDLayers = _nVXDLayers ;
+  walk.rLayer     = _siLayerR ;
+  walk.zHalfLayer = _siLayerZHalf ;
+  walk.maxMissedLayers = _siMaxMissedLayers ;
+  // the acceptance check needs the layer geometry 
+  walk.checkAcceptance = ( _siAcceptanceCheck && int( _siLayerR.size() ) == _nSITLayers + _nVXDLayers ) ;
+  walk.zTolerance = _siAcceptanceZTolerance ;
 
-	  trk->addTrackState( tsv[i] ) ;
-	}
-      } //-----------------------------------------------------------------
+  // ============ sort tracks wrt pt (1./omega) ===============
+  LCCollectionVec* tv  = dynamic_cast<LCCollectionVec*>(trackCol) ;
+
+  if( ! tv ) {
+    streamlog_out( ERROR  ) << " *** pickUpSiTrackerHits() :  dynamic_cast<LCCollectionVec*>(trackCol)  failed !! " << std::endl ; 
+    return ; 
+  }
 
+  std::sort( tv->begin() , tv->end() ,  PtSort()  ) ;
+  
+  unsigned nTrk = tv->size() ;
 
+  std::vector< TrackImpl* > trks( nTrk ) ;
+  for( unsigned i=0 ; i<nTrk ; ++i )
+    trks[i] = dynamic_cast<TrackImpl*>( (*tv)[i] ) ;
 
-      trk->setChi2( chi2 + initial_chi2 ) ;
-      trk->setNdf(  ndf  + initial_ndf  ) ;
+  std::vector< SiPickUp > pickUps( nTrk ) ;
 
-    } else { 
+  // the Kalman tracks kept from the final refit (if any) - they belong to the processor's MarlinTrkSystem
+  std::vector< MarlinTrk::IMarlinTrack* > keptTrks( nTrk , 0 ) ;
+  for( unsigned i=0 ; i<nTrk ; ++i )
+    if( trks[i] ) 
+      keptTrks[i] = keptMarlinTrk( trks[i] , _keepFinalFitRhoTolerance ) ;
 
-      delete tsi ;
+  // count the propagations to silicon layers and the ones saved by the early termination
+  unsigned c_siProp = _counters->registerCounter(" Si layers propagated      " ) ;
+  unsigned c_siSkip = _counters->registerCounter(" Si layers skipped         " ) ;
 
+  auto countLayers = [&](){
+    for( unsigned i=0 ; i<nTrk ; ++i ){
+      _counters->add( c_siProp , pickUps[i].nPropagated ) ;
+      _counters->add( c_siSkip , pickUps[i].nSkipped ) ;
     }
+  } ;
+
+  KalTrackBudget& kalBudget = *_kalBudget ;
+
+  //-------- the tracks claim their hits in the order of decreasing pt 
+
+  for( unsigned i=0 ; i<nTrk ; ++i ){
+      
+    if( ! trks[i] || ! findSiHits( trks[i], keptTrks[i], _trksystem, siHits, walk, _bfield, _dChi2Max, pickUps[i] ) )
+      continue ;
+      
+    // a temporary Kalman track is alive until its hits are added
+    bool tmpTrk = ( pickUps[i].tmpTrk != 0 ) ;
+    if( tmpTrk ) 
+      kalBudget.acquire() ;
+
+    for( unsigned j=0, N=pickUps[i].hits.size() ; j<N ; ++j )
+      siHits.setUsed( pickUps[i].hits[j] ) ;
+
+    addSiHits( trks[i], siHits, pickUps[i] ) ;
+
+    if( tmpTrk ) 
+      kalBudget.release() ;
   }
+
+  countLayers() ;
 }
 
  /*************************************************************************************************/
@@ -1945,7 +2368,61 @@ void ClupatraProcessor::end(){
   streamlog_out( MESSAGE )  << "ClupatraProcessor::end()  " << name() 
 			    << " processed " << _nEvt << " events in " << _nRun << " runs "
 			    << std::endl ;
+
+  // streaming mode: the candidates deferred in the last slice have no next slice to be emitted in 
+  if( _carryOver ){
+
+    unsigned nLost = _carryOver->reset() ;
+
+    if( _counters )
+      _counters->add( _counters->registerCounter(" carried candidates lost   " ) , nLost ) ;
+
+    if( nLost )
+      streamlog_out( WARNING ) << "  streaming mode: " << nLost << " track candidates deferred in the last slice are not emitted " 
+			       << "- their segments are in the collection " << _segmentsOutColName << std::endl ;
+  }
   
+  if( _counters ){
+
+    streamlog_out( MESSAGE )  << _counters->toString( _nEvt ) << std::endl ;
+
+    delete _counters ;
+    _counters = 0 ;
+  }
+
+  if( _kalBudget ){
+
+    struct rusage usage ;
+    getrusage( RUSAGE_SELF , &usage ) ;
+
+    streamlog_out( MESSAGE )  << " max. number of live Kalman tracks in an event : " << _kalBudget->maxPeak() 
+			      << " ( ~ " << _kalBudget->maxPeak() * _kalTrackSizeMB << " MB - budget: " << _kalTrackBudgetMB << " MB ) \n"
+			      << " peak resident memory of the job : " << usage.ru_maxrss / 1024. << " MB " << std::endl ;
+
+    delete _kalBudget ;
+    _kalBudget = 0 ;
+  }
+
+  delete _workspace ;
+  _workspace = 0 ;
+
+  delete _carryOver ;
+  _carryOver = 0 ;
+
+  delete _houghSeeder ;
+  _houghSeeder = 0 ;
+
+  delete _caSeeder ;
+  _caSeeder = 0 ;
+
+  if( _snapshot ){
+
+    streamlog_out( MESSAGE )  << " wrote " << _snapshot->nEvents() << " events to snapshot file " << _snapshotFile << std::endl ;
+
+    delete _snapshot ;
+    _snapshot = 0 ;
+  }
+
 }
 
 
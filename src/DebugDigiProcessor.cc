@@ -31,7 +31,7 @@ using namespace marlin ;
 template <class T>
 int subdet( const T* t){
   
-  static CellIDDecoder<T> idDec(  LCTrackerCellID::encoding_string() ) ;
+  thread_local static CellIDDecoder<T> idDec(  LCTrackerCellID::encoding_string() ) ;
   
   return idDec( t )[ LCTrackerCellID::subdet() ] ;  
 }
@@ -15,7 +15,6 @@
 #include "EVENT/Track.h"
 #include "EVENT/SimTrackerHit.h"
 #include "UTIL/Operators.h"
-#include "UTIL/LCRelationNavigator.h"
 #include "UTIL/LCTypedVector.h"
 #include "UTIL/BitSet32.h"
 
@@ -86,7 +85,7 @@ namespace TrackCheckMCTruthHistos {
 
 class Histograms{
 public:
-  Histograms(std::vector<TH1*>& v) : _h(&v) {}
+  Histograms(std::vector<TH1*>& v, bool enabled=true) : _h(&v), _enabled( enabled ) {}
 
   void create(int idx, const char* n, int nBin=100, double min=0., double max=0. ){
     create( idx , n , n , nBin, min , max ) ; 
@@ -107,11 +106,12 @@ public:
     streamlog_out( DEBUG ) << " create histo " <<  n << " at index " << idx << std::endl ;
   }
 
-  void fill( int idx , double val, double weight=1.0 ){  _h->at( idx )->Fill( val , weight ) ; }
+  void fill( int idx , double val, double weight=1.0 ){  if( _enabled ) _h->at( idx )->Fill( val , weight ) ; }
 
 protected:
 
   std::vector<TH1*>* _h;
+  bool _enabled ;
 };
 
 
@@ -204,6 +204,26 @@ TrackCheckMCTruth::TrackCheckMCTruth() : Processor("TrackCheckMCTruth"),
 			      "Min and max value of pt range [GeV]"  ,
 			      _ptRange ,
 			      ptRange ) ;
+
+  registerProcessorParameter("FillHistograms",
+                             "fill the validation histograms - can be switched off if only the validation tuple is needed",
+                             _fillHistograms,
+                             bool(true));
+
+  registerProcessorParameter("ValidationTupleFile",
+                             "name of the ROOT file for the validation tuple with one row per MCParticle and per track - not written if empty",
+                             _tupleFileName,
+                             std::string(""));
+
+  registerProcessorParameter("AccumulatorFile",
+                             "name of the text file the efficiency counts and pull moments of this job are written to in end() - not written if empty",
+                             _accumulatorFile,
+                             std::string(""));
+
+  registerProcessorParameter("MergeAccumulatorFiles",
+                             "accumulator files of other jobs that are merged in end() before the combined efficiencies are printed (and written)",
+                             _mergeAccumulatorFiles,
+                             StringVec());
   
 }
 
@@ -222,6 +242,12 @@ void TrackCheckMCTruth::init() {
 
   _nRun = 0 ;
   _nEvt = 0 ;
+
+  // efficiency vs pt in the same bins as the histogram hpt_t
+  static const double ptBins[] = { 0.1, 0.2, 0.5 , 1.0 , 2., 5.0 , 10. , 20. , 50. , 100. } ;
+  std::vector<double> ptEdges( ptBins , ptBins + sizeof( ptBins ) / sizeof( double ) ) ;
+
+  _output = new trkval::ValidationOutput( name() , ptEdges , 10 , _tupleFileName ) ;
 }
 
 void TrackCheckMCTruth::processRunHeader( LCRunHeader* ) { 
@@ -244,7 +270,7 @@ void TrackCheckMCTruth::processEvent( LCEvent * evt ) {
 
 
   //----------------------------------------------------------------------
-  Histograms h(_h1) ;
+  Histograms h(_h1, _fillHistograms ) ;
 
   if( isFirstEvent() ){
 
@@ -344,9 +370,9 @@ void TrackCheckMCTruth::processEvent( LCEvent * evt ) {
 
 
 
-  LCRelationNavigator nav( relCol  ) ;
-  
-  LCRelationNavigator navInverse( relInverseCol  ) ;
+  // the truth relation is converted into flat arrays indexed by the MCParticle's dense index 
+  _mcTruth.setMCParticles( evt->getCollection( _mcpColName ) ) ;
+  _mcTruth.setRelation( relCol ) ;
 
   //---------------------------------------------------------------------------------
   // create collections with low, ok and high weight of the truth relation
@@ -424,18 +450,12 @@ void TrackCheckMCTruth::processEvent( LCEvent * evt ) {
 
   //------ count sim hits from every MCParticle
 
-  typedef std::map< MCParticle* , int > HITMAP ;
-  HITMAP hitMap ;
-
   for( unsigned i=0 ,N = _sthColNames.size() ; i<N ; ++i ){
    
     try {
-      LCIterator<SimTrackerHit> sthIt( evt, _sthColNames[i] ) ;
-      
-      while( SimTrackerHit* sth = sthIt.next()  ){
-	
-	hitMap[ sth->getMCParticle() ]++ ;
-      }
+
+      _mcTruth.countSimHits( evt->getCollection( _sthColNames[i] ) ) ;
+
     } catch( lcio::DataNotAvailableException& e){ 
 
       streamlog_out( DEBUG4 ) << " missing input collection: " << _sthColNames[i] << std::endl ;
@@ -474,7 +494,7 @@ void TrackCheckMCTruth::processEvent( LCEvent * evt ) {
 
     APPLY_CUT( DEBUG2, cut, std::abs( cos( p.theta() ) )  < 0.99  ) ; //  | cos( theta ) | > 0.99
 
-    APPLY_CUT( DEBUG2, cut, hitMap[ mcp ]  > 5 ) ; //  require at least 10 TPC hits (particle actually made it to the TPC)
+    APPLY_CUT( DEBUG2, cut, _mcTruth.nSimHits( _mcTruth.index( mcp ) )  > 5 ) ; //  require at least 10 TPC hits (particle actually made it to the TPC)
 
     //....
 
@@ -546,42 +566,55 @@ void TrackCheckMCTruth::processEvent( LCEvent * evt ) {
     h.fill( hpt_t , ptmcp ) ;
     h.fill( hcosth_t , costhmcp ) ;
     h.fill( hacth_t , std::abs( costhmcp) ) ;
-    
-    const EVENT::LCObjectVec& trkV = nav.getRelatedFromObjects( trm ) ;
+
+    const int iMCP = _mcTruth.index( trm ) ;
+
+    // one row per MCParticle in the validation tuple 
+    float* row = _output->newMCPRow( iMCP , _mcTruth , d0mcp , phmcp , ommcp , z0mcp , tLmcp , ptmcp , costhmcp ) ;
+
+    const unsigned nTrk = _mcTruth.nTracks( iMCP ) ;
 
     std::vector<int> splitTrackIndices ;
-    splitTrackIndices.reserve( trkV.size()  ) ;
+    splitTrackIndices.reserve( nTrk  ) ;
+
+    bool foundTrack = false ;
 
-    if( trkV.size() >  0 ){
+    if( nTrk >  0 ){
       
-      const FloatVec& wV = nav.getRelatedFromWeights( trm ) ;
       double wMax = 0.0 ;
       int iMax = 0 ;
       
-      for(unsigned i=0 ; i<wV.size() ; ++i ) {
+      for(unsigned i=0 ; i<nTrk ; ++i ) {
 	
-	if( wV[i] > wMax ){
-	  wMax =  wV[i] ;
+	const float w = _mcTruth.weight( iMCP , i ) ;
+
+	if( w > wMax ){
+	  wMax =  w ;
 	  iMax = i ;
 	}  
 
-	if( wV[i] > 0.5 ) { // if we have a track segment that has a weight >0.5 it could be part of a split track....
+	if( w > 0.5 ) { // if we have a track segment that has a weight >0.5 it could be part of a split track....
 	  splitTrackIndices.push_back( i ) ;
 	}
       } 
       
-      // if(  trkV.size() > 1 ){ // if we have more than one track it is a split track....
+      // if(  nTrk > 1 ){ // if we have more than one track it is a split track....
       // 	std::copy( trkV.begin() , trkV.end() , std::back_inserter( *splitCol ) ) ;
       // }
       if( splitTrackIndices.size() > 1 ){
 
 	for(unsigned i=0,N=splitTrackIndices.size() ; i<N ; ++i ) {
-	  splitCol->addElement(  trkV[i ] ) ;
+	  splitCol->addElement(  _mcTruth.track( iMCP , i ) ) ;
 	}
       }
 
 
-      Track* tr = (Track*)( trkV.at(iMax)  ) ; 
+      Track* tr = _mcTruth.track( iMCP , iMax ) ; 
+
+      if( row ){
+	row[ trkval::MCPColumn::wMax ] = wMax ;
+	trkval::fillTrackParameters( row , trkval::MCPColumn::d0 , tr , alpha ) ;
+      }
 
  
       double d0 = tr->getD0() ;
@@ -627,6 +660,11 @@ void TrackCheckMCTruth::processEvent( LCEvent * evt ) {
       if( cut == true ){
 	
 	mcpTrksFound->push_back( trm ) ;
+
+	foundTrack = true ;
+
+	if( row ) 
+	  row[ trkval::MCPColumn::found ] = 1. ;
 	
 	h.fill( hd0,    d0 ) ;
 	h.fill( hphi,   ph ) ;
@@ -658,6 +696,9 @@ void TrackCheckMCTruth::processEvent( LCEvent * evt ) {
 	h.fill( hptanL,  dtL / etL ) ;
 	h.fill( hppt,    dpt / ept ) ;
 
+	const double pulls[ trkval::ValidationAccumulator::nPulls ] = { dd0 / ed0 , dph / eph , dom / eom , dz0 / ez0 , dtL / etL , dpt / ept } ;
+	_output->accumulator().fillPulls( pulls ) ;
+
 	h.fill( hdptp2,    dpt / (pt*pt) ) ;
 
 
@@ -668,8 +709,13 @@ void TrackCheckMCTruth::processEvent( LCEvent * evt ) {
       }
 
     }
+
+    _output->accumulator().fillTruth( ptmcp , costhmcp , foundTrack ) ;
   }
 
+  // one row per track in the validation tuple 
+  _output->fillTrackTuple( trkCol , _mcTruth , alpha ) ;
+
   streamlog_out( DEBUG4 )  << " ===== found " << mcpTrksFound->size()  <<  " tracks of " << mcpTracks->size()  
 			   << std::endl ;
 
@@ -698,6 +744,11 @@ void TrackCheckMCTruth::check( LCEvent *  ) {
 
 
 void TrackCheckMCTruth::end(){ 
+
+  _output->end( _mergeAccumulatorFiles , _accumulatorFile ) ;
+
+  delete _output ;
+  _output = 0 ;
   
   streamlog_out( MESSAGE )  << " processed " << _nEvt << " events in " << _nRun << " runs "
 			    << std::endl ;
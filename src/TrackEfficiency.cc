@@ -18,7 +18,6 @@
 #include "EVENT/Track.h"
 #include "EVENT/SimTrackerHit.h"
 #include "UTIL/Operators.h"
-#include "UTIL/LCRelationNavigator.h"
 #include "UTIL/LCTypedVector.h"
 #include "UTIL/LCTypedVector.h"
 #include "UTIL/LCTrackerConf.h"
@@ -66,7 +65,7 @@ namespace TrackEfficiencyHistos {
 
   class Histograms{
   public:
-    Histograms(std::vector<TH1*>& v) : _h(&v) {}
+    Histograms(std::vector<TH1*>& v, bool enabled=true) : _h(&v), _enabled( enabled ) {}
 
     void create(int idx, const char* n, int nBin=100, double min=0., double max=0. ){
       create( idx , n , n , nBin, min , max ) ; 
@@ -87,11 +86,12 @@ namespace TrackEfficiencyHistos {
       streamlog_out( DEBUG ) << " create histo " <<  n << " at index " << idx << std::endl ;
     }
 
-    void fill( int idx , double val, double weight=1.0 ){  _h->at( idx )->Fill( val , weight ) ; }
+    void fill( int idx , double val, double weight=1.0 ){  if( _enabled ) _h->at( idx )->Fill( val , weight ) ; }
 
   protected:
 
     std::vector<TH1*>* _h;
+    bool _enabled ;
   };
 
 
@@ -198,6 +198,26 @@ TrackEfficiency::TrackEfficiency() : Processor("TrackEfficiency"),
                              _minHits,
                              int(4));
 
+  registerProcessorParameter("FillHistograms",
+                             "fill the validation histograms - can be switched off if only the validation tuple is needed",
+                             _fillHistograms,
+                             bool(true));
+
+  registerProcessorParameter("ValidationTupleFile",
+                             "name of the ROOT file for the validation tuple with one row per MCParticle and per track - not written if empty",
+                             _tupleFileName,
+                             std::string(""));
+
+  registerProcessorParameter("AccumulatorFile",
+                             "name of the text file the efficiency counts and pull moments of this job are written to in end() - not written if empty",
+                             _accumulatorFile,
+                             std::string(""));
+
+  registerProcessorParameter("MergeAccumulatorFiles",
+                             "accumulator files of other jobs that are merged in end() before the combined efficiencies are printed (and written)",
+                             _mergeAccumulatorFiles,
+                             StringVec());
+
 }
 
 
@@ -217,6 +237,12 @@ void TrackEfficiency::init() {
 
   _nRun = 0 ;
   _nEvt = 0 ;
+
+  // efficiency vs pt in the same bins as the histogram hpt_t
+  static const double ptBins[] = { 0.1, 0.2, 0.4, 0.6 , 0.8 , 1.0 , 2., 5.0 , 10. , 20. , 50. , 100. , 300. , 500. } ;
+  std::vector<double> ptEdges( ptBins , ptBins + sizeof( ptBins ) / sizeof( double ) ) ;
+
+  _output = new trkval::ValidationOutput( name() , ptEdges , 20 , _tupleFileName ) ;
 }
 
 void TrackEfficiency::processRunHeader( LCRunHeader* ) { 
@@ -244,7 +270,7 @@ void TrackEfficiency::processEvent( LCEvent * evt ) {
 
 
   //----------------------------------------------------------------------
-  Histograms h(_h1) ;
+  Histograms h(_h1, _fillHistograms ) ;
 
   if( isFirstEvent() ){
 
@@ -359,8 +385,11 @@ void TrackEfficiency::processEvent( LCEvent * evt ) {
   }
 
 
-  LCRelationNavigator navm2t( m2tCol  ) ;
-  LCRelationNavigator navt2m( t2mCol  ) ;
+  // the truth relations are converted into flat arrays indexed by the MCParticle's dense index 
+  const bool useT2M = true ;
+
+  _mcTruth.setMCParticles( evt->getCollection( _mcpColName ) ) ;
+  _mcTruth.setRelation( ( useT2M ? t2mCol : m2tCol ) , useT2M ) ;
 
 
   LCIterator<MCParticle> mcpIt( evt, _mcpColName ) ;
@@ -396,15 +425,10 @@ void TrackEfficiency::processEvent( LCEvent * evt ) {
   evt->addCollection( splitTracks ,  name  ) ;
   
   //------ count sim hits from every MCParticle
-  typedef std::map< MCParticle* , int > HITMAP ;
-  HITMAP hitMap ;
   try{
-    LCIterator<SimTrackerHit> sthIt( evt, _sthColName ) ;
-    
-    while( SimTrackerHit* sth = sthIt.next()  ){
-      
-      hitMap[ sth->getMCParticle() ]++ ;
-    }
+
+    _mcTruth.countSimHits( evt->getCollection( _sthColName ) ) ;
+
   }catch( lcio::DataNotAvailableException& e){
 
   }
@@ -446,7 +470,7 @@ void TrackEfficiency::processEvent( LCEvent * evt ) {
 
     APPLY_CUT( DEBUG, cut, std::abs( cos( p.theta() ) )  < _cosTheta  ) ; //FIXME 0.9 <=> .99  //  | cos( theta ) | > 0.99
 
-    APPLY_CUT( DEBUG, cut, hitMap[ mcp ]  > _minHits ) ; //  require at least 5 tracker hits 
+    APPLY_CUT( DEBUG, cut, _mcTruth.nSimHits( _mcTruth.index( mcp ) )  > _minHits ) ; //  require at least 5 tracker hits 
 
     //....
 
@@ -522,33 +546,34 @@ void TrackEfficiency::processEvent( LCEvent * evt ) {
     h.fill( hpt_t , ptmcp ) ;
     h.fill( hcosth_t , costhmcp ) ;
     h.fill( hacth_t , std::abs( costhmcp) ) ;
-    
 
-  
-    bool useT2M = true ;
+    const int iMCP = _mcTruth.index( trm ) ;
+
+    // one row per MCParticle in the validation tuple 
+    float* row = _output->newMCPRow( iMCP , _mcTruth , d0mcp , phmcp , ommcp , z0mcp , tLmcp , ptmcp , costhmcp ) ;
 
-    const EVENT::LCObjectVec& trkV = ( useT2M ?   navt2m.getRelatedFromObjects( trm ) :   navm2t.getRelatedToObjects( trm )  ); 
+    const unsigned nTrk = _mcTruth.nTracks( iMCP ) ;
     
-    //    std::cout <<  " ------   trkV.size()  : " << trkV.size()  << std::endl ;
+    //    std::cout <<  " ------   nTrk  : " << nTrk  << std::endl ;
 
     bool foundTrack = false ;
 
-    if( trkV.size() >  0 ){
+    if( nTrk >  0 ){
       
 
-      const FloatVec& wV =  ( useT2M ?  navt2m.getRelatedFromWeights( trm ) :  navm2t.getRelatedToWeights( trm ) ) ;
-
       double wMax = 0.0 ;
       int iMax = 0 ;
 
-      streamlog_out( DEBUG2 ) <<  " ------   trkV.size()  : " << trkV.size()  << std::endl ;
+      streamlog_out( DEBUG2 ) <<  " ------   nTrk  : " << nTrk  << std::endl ;
 
-      for(unsigned i=0 ; i<wV.size() ; ++i ) {
+      for(unsigned i=0 ; i<nTrk ; ++i ) {
 	 
-	streamlog_out( DEBUG2 ) <<  "          nhit  : " << ((Track*)trkV[i])->getTrackerHits().size() <<    " ---- weight : " <<   wV[i]   << std::endl ;
+	const float w = _mcTruth.weight( iMCP , i ) ;
 
-	if( wV[i] > wMax ){
-	  wMax =  wV[i] ;
+	streamlog_out( DEBUG2 ) <<  "          nhit  : " << _mcTruth.track( iMCP , i )->getTrackerHits().size() <<    " ---- weight : " <<   w   << std::endl ;
+
+	if( w > wMax ){
+	  wMax =  w ;
 	  iMax = i ;
 	}  
       } 
@@ -558,21 +583,26 @@ void TrackEfficiency::processEvent( LCEvent * evt ) {
       int nSplitSegments = 0 ;
       
       // store split tracks collection
-      if( trkV.size() >  1 ){
+      if( nTrk >  1 ){
 	
-	for(unsigned i=0,N=trkV.size() ; i<N ; ++i ) {
+	for(unsigned i=0 ; i<nTrk ; ++i ) {
 	  
-	  //	  if(  wV[i] > minGoodHitFraction ) {
+	  //	  if(  _mcTruth.weight( iMCP , i ) > minGoodHitFraction ) {
 	    
 	    ++nSplitSegments ;
 	    
-	    splitTracks->addElement( trkV[i] ) ;
+	    splitTracks->addElement( _mcTruth.track( iMCP , i ) ) ;
 	    //}
 	}
       }
 
 
-      Track* tr = (Track*) ( trkV.at(iMax)  ) ; 
+      Track* tr = _mcTruth.track( iMCP , iMax ) ; 
+
+      if( row ){
+	row[ trkval::MCPColumn::wMax ] = wMax ;
+	trkval::fillTrackParameters( row , trkval::MCPColumn::d0 , tr , alpha ) ;
+      }
  
       double d0 = tr->getD0() ;
       double ph = tr->getPhi() ;
@@ -611,7 +641,7 @@ void TrackEfficiency::processEvent( LCEvent * evt ) {
       // trk->subdetectorHitNumbers()[ 2 * ILDDetID::TPC - 1 ] =  hitsInFit ;  
       // trk->subdetectorHitNumbers()[ 2 * ILDDetID::TPC - 2 ] =  hitCount ;  
       int nTPCHit = tr->getSubdetectorHitNumbers()[ 2 * ILDDetID::TPC - 2 ] ;
-      int nMCPTPCHit = hitMap[ trm ] ;
+      int nMCPTPCHit = _mcTruth.nSimHits( iMCP ) ;
       //      double goodHitFraction = ( wMax * nTPCHit )  / nMCPTPCHit ;
 
       double goodHitFraction = wMax ;
@@ -638,6 +668,9 @@ void TrackEfficiency::processEvent( LCEvent * evt ) {
 	
 	foundTrack = true ;
 
+	if( row ) 
+	  row[ trkval::MCPColumn::found ] = 1. ;
+
 	h.fill( hd0,    d0 ) ;
 	h.fill( hphi,   ph ) ;
 	h.fill( homega, om ) ;
@@ -668,6 +701,9 @@ void TrackEfficiency::processEvent( LCEvent * evt ) {
 	h.fill( hptanL,  dtL / etL ) ;
 	h.fill( hppt,    dpt / ept ) ;
 
+	const double pulls[ trkval::ValidationAccumulator::nPulls ] = { dd0 / ed0 , dph / eph , dom / eom , dz0 / ez0 , dtL / etL , dpt / ept } ;
+	_output->accumulator().fillPulls( pulls ) ;
+
 	h.fill( hdptp2,    dpt / (pt*pt) ) ;
 
 
@@ -679,6 +715,8 @@ void TrackEfficiency::processEvent( LCEvent * evt ) {
       }
     }
     
+    _output->accumulator().fillTruth( ptmcp , costhmcp , foundTrack ) ;
+
     if( ! foundTrack )  {
       mcpTrksNotFound->push_back( trm ) ;
 
@@ -686,6 +724,9 @@ void TrackEfficiency::processEvent( LCEvent * evt ) {
     }
   }
 
+  // one row per track in the validation tuple 
+  _output->fillTrackTuple( trkCol , _mcTruth , alpha ) ;
+
   streamlog_out( DEBUG4 )  << " ===== could not find " << mcpTrksNotFound->size()  <<  " tracks of " << mcpTracks->size()  
 			   << std::endl ;
 
@@ -714,6 +755,11 @@ void TrackEfficiency::check( LCEvent * ) {
 
 
 void TrackEfficiency::end(){ 
+
+  _output->end( _mergeAccumulatorFiles , _accumulatorFile ) ;
+
+  delete _output ;
+  _output = 0 ;
   
   streamlog_out( MESSAGE )  << " processed " << _nEvt << " events in " << _nRun << " runs "
 			    << std::endl ;
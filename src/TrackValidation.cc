@@ -0,0 +1,610 @@
+#include "TrackValidation.h"
+
+#include "EVENT/LCRelation.h"
+#include "EVENT/SimTrackerHit.h"
+#include "UTIL/ILDConf.h"
+#include "UTIL/LCTrackerConf.h"
+
+#include "streamlog/streamlog.h"
+
+#include "TFile.h"
+#include "TTree.h"
+#include "TDirectory.h"
+
+#include <cmath>
+#include <algorithm>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+
+namespace trkval{
+
+  namespace MCPColumn{
+    const char* names[ Size ] = {
+      "d0mc", "phimc", "omegamc", "z0mc", "tanLmc", "ptmc", "costhmc",
+      "nSimHits", "nTrk", "wMax", "found",
+      "d0",  "phi",  "omega",  "z0",  "tanL",  "pt",
+      "ed0", "ephi", "eomega", "ez0", "etanL", "ept"
+    } ;
+  }
+
+  namespace TrackColumn{
+    const char* names[ Size ] = {
+      "d0",  "phi",  "omega",  "z0",  "tanL",  "pt",
+      "ed0", "ephi", "eomega", "ez0", "etanL", "ept",
+      "nHit", "nTPCHit", "nMCP", "wMax"
+    } ;
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  void MCTruthIndex::setMCParticles( EVENT::LCCollection* col ){
+
+    _index.clear() ;
+    _mcps.clear() ;
+    _nSimHits.clear() ;
+    _offset.assign( 1 , 0 ) ;
+    _tracks.clear() ;
+    _weights.clear() ;
+
+    int nMCP = ( col ? col->getNumberOfElements() : 0 ) ;
+
+    _index.reserve( nMCP ) ;
+    _mcps.reserve( nMCP ) ;
+
+    for( int i=0 ; i < nMCP ; ++i ){
+
+      EVENT::MCParticle* mcp = static_cast<EVENT::MCParticle*>( col->getElementAt(i) ) ;
+
+      if( _index.insert( std::make_pair( mcp , (int) _mcps.size() ) ).second )
+	_mcps.push_back( mcp ) ;
+    }
+
+    _nSimHits.assign( _mcps.size() , 0 ) ;
+    _offset.assign( _mcps.size() + 1 , 0 ) ;
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  void MCTruthIndex::countSimHits( EVENT::LCCollection* col ){
+
+    for( int i=0, N=col->getNumberOfElements() ; i < N ; ++i ){
+
+      EVENT::SimTrackerHit* sth = static_cast<EVENT::SimTrackerHit*>( col->getElementAt(i) ) ;
+
+      int idx = index( sth->getMCParticle() ) ;
+
+      if( idx >= 0 )
+	++_nSimHits[ idx ] ;
+    }
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  void MCTruthIndex::setRelation( EVENT::LCCollection* relCol , bool mcpIsTo ){
+
+    const unsigned nMCP = _mcps.size() ;
+    const int nRel = relCol->getNumberOfElements() ;
+
+    _offset.assign( nMCP + 1 , 0 ) ;
+    _relMCP.resize( nRel ) ;
+
+    // count the relations per MCParticle ...
+    for( int i=0 ; i < nRel ; ++i ){
+
+      EVENT::LCRelation* rel = static_cast<EVENT::LCRelation*>( relCol->getElementAt(i) ) ;
+
+      int idx = index( static_cast<EVENT::MCParticle*>( mcpIsTo ? rel->getTo() : rel->getFrom() ) ) ;
+
+      _relMCP[i] = idx ;
+
+      if( idx >= 0 )
+	++_offset[ idx + 1 ] ;
+    }
+
+    for( unsigned i=0 ; i < nMCP ; ++i )
+      _offset[i+1] += _offset[i] ;
+
+    // ... and fill the tracks and weights in the order of the relation collection
+    _tracks.resize( _offset[ nMCP ] ) ;
+    _weights.resize( _offset[ nMCP ] ) ;
+
+    _fillPos.assign( _offset.begin() , _offset.end() - 1 ) ;
+
+    for( int i=0 ; i < nRel ; ++i ){
+
+      int idx = _relMCP[i] ;
+
+      if( idx < 0 )
+	continue ;
+
+      EVENT::LCRelation* rel = static_cast<EVENT::LCRelation*>( relCol->getElementAt(i) ) ;
+
+      unsigned j = _fillPos[ idx ]++ ;
+
+      _tracks[j]  = static_cast<EVENT::Track*>( mcpIsTo ? rel->getFrom() : rel->getTo() ) ;
+      _weights[j] = rel->getWeight() ;
+    }
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  void MCTruthIndex::setTracks( EVENT::LCCollection* trkCol ){
+
+    const int nTrk = trkCol->getNumberOfElements() ;
+
+    _trkNMCP.assign( nTrk , 0 ) ;
+    _trkWMax.assign( nTrk , 0. ) ;
+
+    _trkIndex.clear() ;
+    _trkIndex.reserve( nTrk ) ;
+
+    for( int i=0 ; i < nTrk ; ++i )
+      _trkIndex.insert( std::make_pair( static_cast<EVENT::Track*>( trkCol->getElementAt(i) ) , i ) ) ;
+
+    for( unsigned j=0, N=_tracks.size() ; j < N ; ++j ){
+
+      std::unordered_map< const EVENT::Track*, int >::const_iterator it = _trkIndex.find( _tracks[j] ) ;
+
+      if( it == _trkIndex.end() )
+	continue ;
+
+      ++_trkNMCP[ it->second ] ;
+
+      if( _weights[j] > _trkWMax[ it->second ] )
+	_trkWMax[ it->second ] = _weights[j] ;
+    }
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  void fillTrackParameters( float* row, unsigned first, const EVENT::Track* trk, double alpha ){
+
+    const EVENT::FloatVec& cov = trk->getCovMatrix() ;
+
+    double om = trk->getOmega() ;
+    double eom = std::sqrt( cov[5] ) ;
+
+    float* r = row + first ;
+
+    r[0] = trk->getD0() ;
+    r[1] = trk->getPhi() ;
+    r[2] = om ;
+    r[3] = trk->getZ0() ;
+    r[4] = trk->getTanLambda() ;
+    r[5] = std::abs( alpha / om ) ;
+
+    r[6]  = std::sqrt( cov[0] ) ;
+    r[7]  = std::sqrt( cov[2] ) ;
+    r[8]  = eom ;
+    r[9]  = std::sqrt( cov[9] ) ;
+    r[10] = std::sqrt( cov[14] ) ;
+    r[11] = alpha * eom / ( om * om ) ;
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  void fillTrackTuple( TupleWriter& tuple, EVENT::LCCollection* trkCol, MCTruthIndex& truth, double alpha ){
+
+    truth.setTracks( trkCol ) ;
+
+    for( int i=0, N=trkCol->getNumberOfElements() ; i < N ; ++i ){
+
+      EVENT::Track* trk = static_cast<EVENT::Track*>( trkCol->getElementAt(i) ) ;
+
+      float* row = tuple.newRow() ;
+
+      fillTrackParameters( row , TrackColumn::d0 , trk , alpha ) ;
+
+      const EVENT::IntVec& shn = trk->getSubdetectorHitNumbers() ;
+      const unsigned iTPC = 2 * lcio::ILDDetID::TPC - 2 ;
+
+      row[ TrackColumn::nHit ]    = trk->getTrackerHits().size() ;
+      row[ TrackColumn::nTPCHit ] = ( shn.size() > iTPC  ?  shn[ iTPC ]  :  0 ) ;
+      row[ TrackColumn::nMCP ]    = truth.nMCP( i ) ;
+      row[ TrackColumn::wMax ]    = truth.trackWeight( i ) ;
+    }
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  TupleWriter::TupleWriter( const std::string& treeName, const char** columns, unsigned nColumns, unsigned batchSize ) :
+    _name( treeName ),
+    _columns( columns , columns + nColumns ),
+    _batchSize( batchSize ),
+    _tree(0) {
+
+    _buffer.reserve( _batchSize * nColumns ) ;
+    _row.resize( nColumns ) ;
+  }
+
+  TupleWriter::~TupleWriter(){
+    // the tree is owned by its file
+  }
+
+  void TupleWriter::create( TFile* file ){
+
+    TDirectory::TContext context( file ) ;
+
+    _tree = new TTree( _name.c_str() , _name.c_str() ) ;
+
+    for( unsigned i=0, N=_columns.size() ; i < N ; ++i ){
+
+      std::string leaf = _columns[i] + "/F" ;
+
+      _tree->Branch( _columns[i].c_str() , &_row[i] , leaf.c_str() ) ;
+    }
+  }
+
+  float* TupleWriter::newRow(){
+
+    const unsigned nCol = _row.size() ;
+
+    if( _tree != 0 && _buffer.size() >= _batchSize * nCol )
+      flush() ;
+
+    _buffer.resize( _buffer.size() + nCol , 0. ) ;
+
+    return &_buffer[ _buffer.size() - nCol ] ;
+  }
+
+  void TupleWriter::flush(){
+
+    if( _tree == 0 )
+      return ;
+
+    const unsigned nCol = _row.size() ;
+
+    for( unsigned i=0, N=_buffer.size() ; i < N ; i += nCol ){
+
+      std::copy( _buffer.begin() + i , _buffer.begin() + i + nCol , _row.begin() ) ;
+
+      _tree->Fill() ;
+    }
+
+    _buffer.clear() ;
+  }
+
+  void TupleWriter::write(){
+
+    flush() ;
+
+    if( _tree != 0 ){
+
+      TDirectory::TContext context( _tree->GetDirectory() ) ;
+
+      _tree->Write() ;
+    }
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  void Moments::merge( const Moments& o ){
+
+    if( o.n == 0 ) 
+      return ;
+
+    unsigned long nTot = n + o.n ;
+    double d = o.mean - mean ;
+
+    mean += d * o.n / nTot ;
+    m2   += o.m2 + d * d * double( n ) * o.n / nTot ;
+    n     = nTot ;
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  EfficiencyCounter::EfficiencyCounter( const std::vector<double>& binEdges ) :
+    _edges( binEdges ),
+    _nTrue( binEdges.size() > 1  ?  binEdges.size() - 1  :  0 , 0 ),
+    _nFound( _nTrue.size() , 0 ) {
+  }
+
+  void EfficiencyCounter::fill( double x, bool found ){
+
+    if( _nTrue.empty() || x < _edges.front() || x >= _edges.back() )
+      return ;
+
+    unsigned i = std::upper_bound( _edges.begin() , _edges.end() , x ) - _edges.begin() - 1 ;
+
+    ++_nTrue[i] ;
+
+    if( found )
+      ++_nFound[i] ;
+  }
+
+  void EfficiencyCounter::merge( const EfficiencyCounter& o ){
+
+    if( o._edges != _edges )
+      throw lcio::Exception( "trkval::EfficiencyCounter::merge: different binning" ) ;
+
+    for( unsigned i=0, N=_nTrue.size() ; i<N ; ++i ){
+      _nTrue[i]  += o._nTrue[i] ;
+      _nFound[i] += o._nFound[i] ;
+    }
+  }
+
+  void EfficiencyCounter::write( std::ostream& os ) const {
+
+    os << nBins() ;
+    for( unsigned i=0, N=_edges.size() ; i<N ; ++i )
+      os << " " << _edges[i] ;
+    os << "\n" ;
+
+    for( unsigned i=0, N=nBins() ; i<N ; ++i )
+      os << " " << _nTrue[i] << " " << _nFound[i] ;
+    os << "\n" ;
+  }
+
+  void EfficiencyCounter::read( std::istream& is ){
+
+    unsigned n = 0 ;
+    is >> n ;
+
+    std::vector<double> edges( is && n == nBins()  ?  _edges.size()  :  0 ) ;
+
+    for( unsigned i=0, N=edges.size() ; i<N ; ++i )
+      is >> edges[i] ;
+
+    if( ! is || n != nBins() || edges != _edges )
+      throw lcio::Exception( "trkval::EfficiencyCounter::read: different binning" ) ;
+
+    for( unsigned i=0 ; i<n ; ++i )
+      is >> _nTrue[i] >> _nFound[i] ;
+
+    if( ! is )
+      throw lcio::Exception( "trkval::EfficiencyCounter::read: cannot read counts" ) ;
+  }
+
+  double EfficiencyCounter::error( unsigned i ) const {
+
+    if( _nTrue[i] == 0 )
+      return 0. ;
+
+    double eff = efficiency( i ) ;
+
+    return std::sqrt( eff * ( 1. - eff ) / _nTrue[i] ) ;
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  namespace{
+
+    std::vector<double> uniformEdges( unsigned nBins , double min , double max ){
+
+      std::vector<double> edges( nBins + 1 ) ;
+
+      for( unsigned i=0 ; i<=nBins ; ++i )
+	edges[i] = min + ( max - min ) * i / nBins ;
+
+      return edges ;
+    }
+
+    const char* pullNames[ ValidationAccumulator::nPulls ] = { "d0", "phi", "omega", "z0", "tanL", "pt" } ;
+
+    void writeCounter( std::ostream& os, const char* name, const EfficiencyCounter& c ){
+
+      os << name << " " ;
+      c.write( os ) ;
+    }
+
+    void readCounter( std::istream& is, const char* name, EfficiencyCounter& c ){
+
+      std::string tag ;
+
+      is >> tag ;
+
+      if( ! is || tag != name )
+	throw lcio::Exception( std::string( "trkval::ValidationAccumulator::read: cannot read efficiency " ) + name ) ;
+
+      c.read( is ) ;
+    }
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  ValidationAccumulator::ValidationAccumulator( const std::vector<double>& ptEdges , unsigned nCosThetaBins ) :
+    _effPt( ptEdges ),
+    _effCosTh( uniformEdges( nCosThetaBins , -1. , 1. ) ),
+    _effAbsCosTh( uniformEdges( nCosThetaBins , 0. , 1. ) ) {
+  }
+
+  void ValidationAccumulator::fillTruth( double pt, double cosTheta, bool found ){
+
+    std::lock_guard<std::mutex> lock( _mutex ) ;
+
+    _effPt.fill( pt , found ) ;
+    _effCosTh.fill( cosTheta , found ) ;
+    _effAbsCosTh.fill( std::abs( cosTheta ) , found ) ;
+  }
+
+  void ValidationAccumulator::fillPulls( const double* pulls ){
+
+    std::lock_guard<std::mutex> lock( _mutex ) ;
+
+    for( unsigned i=0 ; i<nPulls ; ++i )
+      _pulls[i].add( pulls[i] ) ;
+  }
+
+  void ValidationAccumulator::merge( const ValidationAccumulator& o ){
+
+    if( &o == this ) 
+      return ;
+
+    std::lock( _mutex , o._mutex ) ;
+    std::lock_guard<std::mutex> lock0( _mutex , std::adopt_lock ) ;
+    std::lock_guard<std::mutex> lock1( o._mutex , std::adopt_lock ) ;
+
+    _effPt.merge( o._effPt ) ;
+    _effCosTh.merge( o._effCosTh ) ;
+    _effAbsCosTh.merge( o._effAbsCosTh ) ;
+
+    for( unsigned i=0 ; i<nPulls ; ++i )
+      _pulls[i].merge( o._pulls[i] ) ;
+  }
+
+  void ValidationAccumulator::write( std::ostream& os ) const {
+
+    std::lock_guard<std::mutex> lock( _mutex ) ;
+
+    os << "trkval::ValidationAccumulator 1\n" << std::setprecision( 17 ) ;
+
+    writeCounter( os , "pt" ,        _effPt ) ;
+    writeCounter( os , "costh" ,     _effCosTh ) ;
+    writeCounter( os , "abscosth" ,  _effAbsCosTh ) ;
+
+    for( unsigned i=0 ; i<nPulls ; ++i )
+      os << pullNames[i] << " " << _pulls[i].n << " " << _pulls[i].mean << " " << _pulls[i].m2 << "\n" ;
+  }
+
+  void ValidationAccumulator::read( std::istream& is ){
+
+    std::string tag ;
+    int version = 0 ;
+
+    is >> tag >> version ;
+
+    if( ! is || tag != "trkval::ValidationAccumulator" || version != 1 )
+      throw lcio::Exception( "trkval::ValidationAccumulator::read: unknown format" ) ;
+
+    // read into an accumulator with the same binning first - nothing is merged from an incomplete file
+    ValidationAccumulator o( _effPt.edges() , _effCosTh.nBins() ) ;
+
+    readCounter( is , "pt" ,        o._effPt ) ;
+    readCounter( is , "costh" ,     o._effCosTh ) ;
+    readCounter( is , "abscosth" ,  o._effAbsCosTh ) ;
+
+    for( unsigned i=0 ; i<nPulls ; ++i ){
+
+      Moments& m = o._pulls[i] ;
+      is >> tag >> m.n >> m.mean >> m.m2 ;
+
+      if( ! is || tag != pullNames[i] )
+	throw lcio::Exception( "trkval::ValidationAccumulator::read: cannot read pull moments" ) ;
+    }
+
+    merge( o ) ;
+  }
+
+  void ValidationAccumulator::print( std::ostream& os ) const {
+
+    std::lock_guard<std::mutex> lock( _mutex ) ;
+
+    const EfficiencyCounter* effs[3] = { &_effPt , &_effCosTh , &_effAbsCosTh } ;
+    const char* names[3] = { "pt [GeV]" , "cos(theta)" , "|cos(theta)|" } ;
+
+    for( unsigned k=0 ; k<3 ; ++k ){
+
+      os << " ---- tracking efficiency vs. " << names[k] << "\n" ;
+
+      for( unsigned i=0, N=effs[k]->nBins() ; i<N ; ++i )
+	os << "   [ " << std::setw(8) << effs[k]->low(i) << " , " << std::setw(8) << effs[k]->high(i) << " ) : "
+	   << std::setw(10) << effs[k]->efficiency(i) << " +/- " << std::setw(10) << effs[k]->error(i)
+	   << "   ( " << effs[k]->nFound(i) << " / " << effs[k]->nTrue(i) << " )\n" ;
+    }
+
+    os << " ---- pulls : mean  rms   (n) \n" ;
+
+    for( unsigned i=0 ; i<nPulls ; ++i )
+      os << "   " << std::setw(6) << pullNames[i] << " : " << std::setw(10) << _pulls[i].mean 
+	 << "  " << std::setw(10) << std::sqrt( _pulls[i].variance() ) << "   ( " << _pulls[i].n << " )\n" ;
+  }
+
+  //------------------------------------------------------------------------------------------
+
+  ValidationOutput::ValidationOutput( const std::string& name, const std::vector<double>& ptEdges, unsigned nCosThetaBins, 
+				      const std::string& tupleFileName ) :
+    _accumulator( ptEdges , nCosThetaBins ),
+    _file(0),
+    _mcpTuple(0),
+    _trkTuple(0) {
+
+    if( tupleFileName.empty() )
+      return ;
+
+    {
+      // a new TFile becomes the current directory 
+      TDirectory::TContext context ;
+
+      _file = new TFile( tupleFileName.c_str() , "RECREATE" ) ;
+    }
+
+    _mcpTuple = new TupleWriter( name + "_mcp" , MCPColumn::names , MCPColumn::Size ) ;
+    _trkTuple = new TupleWriter( name + "_trk" , TrackColumn::names , TrackColumn::Size ) ;
+
+    _mcpTuple->create( _file ) ;
+    _trkTuple->create( _file ) ;
+  }
+
+  ValidationOutput::~ValidationOutput(){
+
+    delete _mcpTuple ;
+    delete _trkTuple ;
+    delete _file ;
+  }
+
+  float* ValidationOutput::newMCPRow( int iMCP, const MCTruthIndex& truth, double d0, double phi, double omega, double z0, double tanL, 
+				      double pt, double cosTheta ){
+
+    if( ! _mcpTuple )
+      return 0 ;
+
+    float* row = _mcpTuple->newRow() ;
+
+    row[ MCPColumn::d0mc ]     = d0 ;
+    row[ MCPColumn::phimc ]    = phi ;
+    row[ MCPColumn::omegamc ]  = omega ;
+    row[ MCPColumn::z0mc ]     = z0 ;
+    row[ MCPColumn::tanLmc ]   = tanL ;
+    row[ MCPColumn::ptmc ]     = pt ;
+    row[ MCPColumn::costhmc ]  = cosTheta ;
+    row[ MCPColumn::nSimHits ] = truth.nSimHits( iMCP ) ;
+    row[ MCPColumn::nTrk ]     = truth.nTracks( iMCP ) ;
+
+    return row ;
+  }
+
+  void ValidationOutput::fillTrackTuple( EVENT::LCCollection* trkCol, MCTruthIndex& truth, double alpha ){
+
+    if( _trkTuple ) 
+      trkval::fillTrackTuple( *_trkTuple , trkCol , truth , alpha ) ;
+  }
+
+  void ValidationOutput::end( const std::vector<std::string>& mergeFiles, const std::string& accumulatorFile ){
+
+    // combine the results of other jobs with this one
+    for( unsigned i=0, N=mergeFiles.size() ; i<N ; ++i ){
+
+      std::ifstream in( mergeFiles[i].c_str() ) ;
+
+      if( ! in )
+	throw lcio::Exception( "trkval::ValidationOutput::end: cannot open accumulator file " + mergeFiles[i] ) ;
+
+      _accumulator.read( in ) ;
+    }
+
+    std::stringstream summary ;
+    _accumulator.print( summary ) ;
+
+    streamlog_out( MESSAGE ) << " ===== validation summary " << ( mergeFiles.empty() ? "" : "(merged jobs) " ) 
+			     << ": \n" << summary.str() << std::endl ;
+
+    if( ! accumulatorFile.empty() ){
+
+      std::ofstream out( accumulatorFile.c_str() ) ;
+
+      _accumulator.write( out ) ;
+    }
+
+    if( _file ){
+
+      _mcpTuple->write() ;
+      _trkTuple->write() ;
+
+      _file->Close() ;
+    }
+  }
+
+  //------------------------------------------------------------------------------------------
+
+}
@@ -1,6 +1,8 @@
 #include "clupatra_new.h"
 #include <set>
 #include <vector>
+#include <cstring>
+#include <cfloat>
 
 
 #include <UTIL/BitField64.h>
@@ -11,6 +13,7 @@
 #include "marlin/Global.h"
 
 #include "IMPL/TrackerHitImpl.h"
+#include "EVENT/TrackerHitPlane.h"
 #include "IMPL/TrackStateImpl.h"
 
 #include "MarlinTrk/Factory.h"
@@ -88,9 +91,10 @@ namespace clupatra_new{
     const int maxTPCLayerID  = tpc->maxRow ;
 
     
-    clu->sort( LayerSortIn() ) ;
-    
-    int layer =  ( backward ?  clu->front()->first->layer : clu->back()->first->layer   ) ; 
+    // start from the outermost (innermost) layer of the cluster  - no need to sort the cluster for this 
+    const CluTrack::summary_type& cluSummary = clu->summary() ;
+
+    int layer =  ( backward ?  cluSummary.maxLayer : cluSummary.minLayer   ) ; 
 
     
     streamlog_out( DEBUG3 ) <<  " ======================  addHitsAndFilter():  - layer " << layer << "  backward: " << backward << std::endl  ;
@@ -139,6 +143,11 @@ namespace clupatra_new{
       streamlog_out( DEBUG3 ) << "\n" ;
     }
 
+    // the fitter sorts the cluster with increasing layer and hits are added below such that this order is kept - 
+    // only sort if the cluster has been modified otherwise in between
+    if( ! std::is_sorted( clu->begin() , clu->end() , LayerSortOut() ) ) 
+      clu->sort( LayerSortOut() ) ;
+
     unsigned step = 0 ;
     
     UTIL::BitField64 encoder( UTIL::LCTrackerCellID::encoding_string() ) ; 
@@ -150,8 +159,8 @@ namespace clupatra_new{
 
     if( trkSys && backward  ) { //==================== only active if called with _trkSystem pointer ============================
 
-      // need to go back in cluster until 4th hit from the start 
-      CluTrack::iterator it =  clu->begin() , end = clu->end() ;
+      // need to go back in cluster until 4th hit from the start (the cluster is ordered with increasing layer)
+      CluTrack::reverse_iterator it =  clu->rbegin() , end = clu->rend() ;
       int i=0 ;
       for(     ; it++ != end && i< 3 ;  ++i  ) ;
 
@@ -298,7 +307,12 @@ namespace clupatra_new{
 	      hitAdded = true ;
 	      
 	      hLL.remove(  bestHit ) ;
-	      clu->addElement( bestHit ) ;
+
+	      // keep the cluster ordered with increasing layer
+	      if( backward )
+		clu->addElement( bestHit ) ;
+	      else
+		clu->addElementFront( bestHit ) ;
 	      
 	      firstHit = 0 ; // after we added a hit, the next intersection search should use this last hit...
 	      
@@ -328,6 +342,138 @@ namespace clupatra_new{
 
   }
 
+  //------------------------------------------------------------------------------------------------------------
+
+  int ClusterExtender::operator()( Clusterer::cluster_list& clusters ){
+
+    int nHitsAdded = 0 ;
+
+    for( Clusterer::cluster_list::iterator it = clusters.begin(), end = clusters.end() ; it != end ; ++it )
+      nHitsAdded += (*this)( *it ) ;
+
+    return nHitsAdded ;
+  }
+
+  int ClusterExtender::operator()( CluTrack* clu ){
+
+    MarlinTrk::IMarlinTrack* trk = _fitter( clu ) ;
+
+    if( _budget ) 
+      _budget->acquire() ;
+
+    streamlog_out( DEBUG5 ) << " extending cluster of length " << clu->size() << std::endl ;
+
+    int nHitsAdded = addHitsAndFilter( clu , *_hLV , _dChi2Max, _chi2Cut , _maxStep , *_zIndex ) ; 
+    static const bool backward = true ;
+    nHitsAdded += addHitsAndFilter( clu , *_hLV , _dChi2Max, _chi2Cut , _maxStep , *_zIndex, backward ) ; 
+
+    // done with the KalTest track - unless it is kept for the final refit
+    if( ! _keepTrks || ! keepExtensionTrk( clu , trk , _budget ) ){
+
+      clu->ext<MarTrk>() = 0 ;
+      delete trk ;
+
+      if( _budget ) 
+	_budget->release() ;
+    }
+
+    return nHitsAdded ;
+  }
+
+  //------------------------------------------------------------------------------------------------------------
+
+  size_t hitHash( const CluTrack* clu ){
+
+    size_t hash = 0 ;
+
+    // sum of the mixed bits of the hit addresses (splitmix64 finalizer)
+    for( CluTrack::const_iterator it=clu->begin(), end =clu->end() ;   it != end ; ++ it ){
+
+      unsigned long long x = (unsigned long long) (size_t) (*it)->first ;
+      x = ( x ^ ( x >> 30 ) ) * 0xbf58476d1ce4e5b9ULL ;
+      x = ( x ^ ( x >> 27 ) ) * 0x94d049bb133111ebULL ;
+      hash += size_t( x ^ ( x >> 31 ) ) ;
+    }
+
+    return hash ;
+  }
+
+  ExtensionTrkStruct::~ExtensionTrkStruct(){
+
+    if( trk == 0 ) 
+      return ;
+
+    delete trk ;
+
+    if( budget ) 
+      budget->release() ;
+  }
+
+  bool keepExtensionTrk( CluTrack* clu, MarlinTrk::IMarlinTrack* trk, KalTrackBudget* budget ){
+
+    if( clu->empty() ) 
+      return false ;
+
+    // leave room for one track in the later stages
+    if( budget && budget->available() < 1 ){
+
+      budget->countRelease() ;
+      return false ;
+    }
+
+    // a track kept from an earlier extension of the cluster
+    delete clu->ext<ExtensionTrk>() ;
+
+    clu->ext<ExtensionTrk>() = new ExtensionTrkStruct( trk , clu->size() , hitHash( clu ) , budget ) ;
+    clu->ext<MarTrk>() = 0 ;
+
+    return true ;
+  }
+
+  MarlinTrk::IMarlinTrack* takeExtensionTrk( CluTrack* clu, const IMarlinTrkFitter& fit ){
+
+    ExtensionTrkStruct* et = clu->ext<ExtensionTrk>() ;
+
+    if( et == 0 ) 
+      return 0 ;
+
+    clu->ext<ExtensionTrk>() = 0 ;
+
+    MarlinTrk::IMarlinTrack* trk = 0 ;
+
+    if( et->nHit == clu->size()  &&  et->hash == hitHash( clu ) ){
+
+      // the converter takes the first and last hit from the hits in the fit - they need to be in the order of the refit,
+      // which is not the case if hits have been added in both directions in the extension
+      std::vector< lcio::TrackerHit* > hits ;
+      unsigned nPrefix = 0 ;
+      fit.hitOrder( clu , hits , nPrefix ) ;
+
+      std::vector<std::pair<EVENT::TrackerHit*, double> > hitsInFit ;
+      et->trk->getHitsInFit( hitsInFit ) ;
+
+      unsigned j = 0 ;
+      bool inOrder = ! hitsInFit.empty() ;
+
+      for( unsigned i=0, N=hitsInFit.size() ; i<N && inOrder ; ++i , ++j ){
+
+	while( j < hits.size() && hits[j] != hitsInFit[i].first ) 
+	  ++j ;
+
+	inOrder = ( j < hits.size() ) ;
+      }
+
+      if( inOrder ){
+	trk = et->take() ;
+	clu->ext<MarTrk>() = trk ;
+      }
+    }
+
+    delete et ;
+
+    return trk ;
+  }
+
   //------------------------------------------------------------------------------------------------------------
   
   bool addHitAndFilter( int detectorID, int layer, CluTrack* clu, HitListVector& hLV , double dChi2Max, double chi2Cut) {
@@ -437,32 +583,57 @@ namespace clupatra_new{
   }
 
 
+  //------------------------------------------------------------------------------------------------------------
+
+  LayerMultiplicities::LayerMultiplicities( const CluTrack* clu ){
+
+    // sorting the layer numbers of the hits gives the hits per layer as runs - no per layer vector needed
+    std::vector<int> layers ;
+    layers.reserve( clu->size() ) ;
+
+    for( CluTrack::const_iterator it=clu->begin(), end =clu->end() ;   it != end ; ++ it ){
+      if( (*it)->first->layer >= 0 ) 
+	layers.push_back( (*it)->first->layer ) ;
+    }
+
+    std::sort( layers.begin() , layers.end() ) ;
+
+    for( unsigned i=0, n=layers.size() ; i < n ; ){
+
+      unsigned j = i + 1 ;
+      while( j < n && layers[j] == layers[i] ) 
+	++j ;
+
+      unsigned m = j - i ;
+
+      if( nLayersWithMult.size() <= m ) 
+	nLayersWithMult.resize( m + 1 ) ;
+
+      ++nLayersWithMult[m] ;
+
+      if( m > 1 ) 
+	nDuplicate += m ;
+
+      i = j ;
+    }
+  }
+
   //------------------------------------------------------------------------------------------------------------
 
   void getHitMultiplicities( CluTrack* clu, std::vector<int>& mult ){
     
-    std::map<int, unsigned > hm ;
-    
-    for( CluTrack::iterator it=clu->begin(), end =clu->end() ;   it != end ; ++ it ){
-      
-      ++hm[ (*it)->first->layer ] ;
-    }
+    LayerMultiplicities lm( clu ) ;
+    const std::vector<unsigned>& nLayersWithMult = lm.nLayersWithMult ;
 
     unsigned maxN = mult.size() - 1 ;
 
-    //    for( unsigned i=0 ; i < hLV.size() ; ++i ){
-    //      unsigned m =  hLV[i].size() ;  
-      
-    for( std::map<int, unsigned>::iterator it= hm.begin() , end = hm.end() ; it != end ; ++ it ){
-      
-      unsigned m = ( it->second < maxN ?  it->second  :  maxN   ) ;
+    for( unsigned i=1, n=nLayersWithMult.size() ; i < n ; ++i ){
       
-      if( m == 0 ) 
-	continue ;
+      unsigned m = ( i < maxN ?  i  :  maxN   ) ;
       
-      ++mult[m] ;
+      mult[m] += nLayersWithMult[i] ;
       
-      ++mult[0] ;
+      mult[0] += nLayersWithMult[i] ;
     }
   }
 
@@ -1020,271 +1191,988 @@ namespace clupatra_new{
 
   //------------------------------------------------------------------------------------------------------------------------- 
 
-  MarlinTrk::IMarlinTrack* IMarlinTrkFitter::operator() (CluTrack* clu) {  
-    
-    bool isFirstFit = true ;
-    double maxChi2  =  _maxChi2Increment   ;
-    
-  start:
-    
-    MarlinTrk::IMarlinTrack* trk = _ts->createTrack();
+  void findSeedClusters( HitListVector& hitsInLayer, HitVec& windowHits, int outerRow, int padRowRange, double dCut, double cosAlphaCut, 
+			 unsigned minCluSize, unsigned maxTPCLayers, float duplicatePadRowFraction, Clusterer::cluster_list& sclu ){
+
+    Clusterer nncl ;
+
+    HitDistance dist( dCut , cosAlphaCut ) ;
+
+    HitVec& hits = windowHits ;
+    hits.clear() ;
     
-    //if( clu->empty()  ){
-    if( clu->size() < 3  ){
-      
-      streamlog_out( ERROR ) << " IMarlinTrkFitter::operator() : cannot fit cluster track with less than 3 hits ! " << std::endl ;
-      
-      return trk ;
+    // add all hits in pad row range to hits
+    for(int iRow = outerRow ; iRow > ( outerRow - padRowRange) ; --iRow ) {
+
+	if( iRow > -1 ) {
+
+	  streamlog_out( DEBUG0 ) << "  copy " <<  hitsInLayer[ iRow ].size() << " hits for row " << iRow << std::endl ;
+
+	  std::copy( hitsInLayer[ iRow ].begin() , hitsInLayer[ iRow ].end() , std::back_inserter( hits )  ) ;
+	}
     }
     
-    clu->ext<MarTrk>() = trk ;
-    
-    clu->sort( LayerSortOut() ) ;
-    
-    // need to reverse the order for incomming track segments (curlers)
-    // assume particle comes from IP
-    Hit* hf = clu->front() ;
-    Hit* hb = clu->back() ;
-    
-    bool reverse_order =   ( std::abs( hf->first->pos.z() ) > std::abs( hb->first->pos.z()) + 3. ) ;
+    //-----  cluster in given pad row range  -----------------------------
     
-    unsigned nHit = 0 ;
+    streamlog_out( DEBUG2 ) << "   call cluster_sorted with " <<  hits.size() << " hits " << std::endl ;
 
-    if( reverse_order ){
-      
-      for( CluTrack::reverse_iterator it=clu->rbegin() ; it != clu->rend() ; ++it){   
+    nncl.cluster_sorted( hits.begin(), hits.end() , std::back_inserter( sclu ), dist , minCluSize ) ;
+    
+    const static int merge_seeds = true ; 
+
+    if( merge_seeds ) { //-----------------------------------------------------------------------
+	
+	// sometimes we have split seed clusters as one link is just above the cut
+	// -> recluster in all hits of small clusters with 1.2 * cut 
+	float _smallClusterPadRowFraction = 0.9  ;
+	float _cutIncrease = 1.2 ;
+	// fixme: could make parameters ....
+
+	HitVec seedhits ;
+	Clusterer::cluster_list smallclu ; 
+	smallclu.setOwner() ;      
+	split_list( sclu, std::back_inserter(smallclu),  ClusterSize(  int( padRowRange * _smallClusterPadRowFraction) ) ) ; 
+	for( Clusterer::cluster_list::iterator sci=smallclu.begin(), end= smallclu.end() ; sci!=end; ++sci ){
+	  for( Clusterer::cluster_type::iterator ci=(*sci)->begin(), end1= (*sci)->end() ; ci!=end1;++ci ){
+	    seedhits.push_back( *ci ) ; 
+	  }
+	}
+	// free hits from bad clusters 
+	std::for_each( smallclu.begin(), smallclu.end(), std::mem_fun( &CluTrack::freeElements ) ) ;
 	
-	trk->addHit( (*it)->first->lcioHit  ) ; 
-	++nHit ;
+	HitDistance distLarge( dCut * _cutIncrease ) ;
 
-	streamlog_out( DEBUG1 ) <<  "   hit  added  " <<  *(*it)->first->lcioHit   << std::endl ;
-      }
-      
-      trk->initialise( MarlinTrk::IMarlinTrack::forward ) ;
-      
-    } else {
-      
-      for( CluTrack::iterator it=clu->begin() ; it != clu->end() ; ++it){   
-	
-	trk->addHit( (*it)->first->lcioHit   ) ; 
-	++nHit ;
+	nncl.cluster_sorted( seedhits.begin(), seedhits.end() , std::back_inserter( sclu ), distLarge , minCluSize ) ;
+
+    } //------------------------------------------------------------------------------------------
+
+    streamlog_out( DEBUG3 ) << "     found " <<  sclu.size() << "  clusters " << std::endl ;
+
+    // try to split up clusters according to multiplicity
+    int layerWithMultiplicity = padRowRange - 2  ; // fixme: make parameter 
+    split_multiplicity( sclu , layerWithMultiplicity , 10 ) ;
+
+
+    // remove clusters whith too many duplicate hits per pad row
+    Clusterer::cluster_list bclu ;    // bad clusters  
+    bclu.setOwner() ;      
+    split_list( sclu, std::back_inserter(bclu),  DuplicatePadRows( maxTPCLayers, duplicatePadRowFraction  ) ) ;
+    // free hits from bad clusters 
+    std::for_each( bclu.begin(), bclu.end(), std::mem_fun( &CluTrack::freeElements ) ) ;
+
+     
+    // ---- now we also need to remove the hits from good cluster seeds from the hitsInLayers:
+    for( Clusterer::cluster_list::iterator sci=sclu.begin(), end= sclu.end() ; sci!=end; ++sci ){
+	for( Clusterer::cluster_type::iterator ci=(*sci)->begin(), end1= (*sci)->end() ; ci!=end1;++ci ){
 	
-	streamlog_out( DEBUG1 ) <<  "   hit  added  "<<  *(*it)->first->lcioHit   << std::endl ;
-      }
-      
-      trk->initialise( MarlinTrk::IMarlinTrack::backward ) ;
+	  // this is not cheap ...
+	  hitsInLayer[ (*ci)->first->layer ].remove( *ci )  ; 
+	}
     }
-    
-    
-    int code = trk->fit(  maxChi2  ) ;
-    
-    if( code != MarlinTrk::IMarlinTrack::success ){
-      
-      streamlog_out( ERROR ) << "  >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>> IMarlinTrkFitter :  problem fitting track "
-			     << " error code : " << MarlinTrk::errorCode( code ) 
-			     << std::endl ; 
-      
+  }
+
+  //------------------------------------------------------------------------------------------------------------------------- 
+
+  HoughSeeder::HoughSeeder( unsigned nPhiBins, unsigned nKappaBins, double maxKappa, double zCut, unsigned minHits ) :
+    _nPhi( nPhiBins ), 
+    _nKappa( nKappaBins ), 
+    _maxKappa( maxKappa ), 
+    _kappaScale( nKappaBins / maxKappa ), 
+    _zCut( zCut ), 
+    _minHits( minHits ) {
+
+    _cosPhi.resize( _nPhi ) ;
+    _sinPhi.resize( _nPhi ) ;
+
+    for( unsigned i=0 ; i<_nPhi ; ++i ){
+      double phi = 2. * M_PI * ( i + 0.5 ) / _nPhi ;
+      _cosPhi[i] = std::cos( phi ) ;
+      _sinPhi[i] = std::sin( phi ) ;
     }
-    
+  }
 
-    //----- if the fit did not fail but has a small number of hits used,
-    //      we try again one more time with a larger max-chi2-increment
-    
-    std::vector<std::pair<EVENT::TrackerHit*, double> > hitsInFit ;
-    trk->getHitsInFit( hitsInFit ) ;
+  void HoughSeeder::computeKappaBins( unsigned iPhi ){
 
-    if( isFirstFit  && ( 1.*hitsInFit.size()) / (1.*nHit )  <  0.2  ) {  // fixme: parameter  
-      
-      isFirstFit = false ;
-      
-      maxChi2 =  2. * _maxChi2Increment  ;
-      
-      streamlog_out( DEBUG4 ) << "  >>>>>>  IMarlinTrkFitter :  small number of hits used in fit " << hitsInFit.size() << "/" << nHit << " = " 
-			      << ( 1.*hitsInFit.size()) / (1.*nHit )  << " refit with larger max chi2 increment:  " << maxChi2 <<  std::endl ;
-      delete trk ;
+    const float c = _cosPhi[ iPhi ] ;
+    const float s = _sinPhi[ iPhi ] ;
+    const unsigned nHit = _hits.size() ;
 
-      goto start ;   // ;-)
-    }
-    //----------------------------------------------------------------------
+    const float* u = &_u[0] ;
+    const float* v = &_v[0] ;
+    unsigned* kBin = &_kBin[0] ;
 
-    return trk;
+    // no branches - kappa outside [0,maxKappa) goes to the overflow bin nKappa
+    for( unsigned i=0 ; i<nHit ; ++i )
+      kBin[i] = kappaBin( u[i] , v[i] , c , s ) ;
   }
-  
-  
-  //---------------------------------------------------------------------------------------------------------------------------
-
-   lcio::Track* LCIOTrackConverter::operator() (CluTrack* c) {  
-    
-    static lcio::BitField64 encoder( lcio::LCTrackerCellID::encoding_string() ) ; 
 
-    lcio::TrackImpl* trk = new lcio::TrackImpl ;
+  CluTrack* HoughSeeder::makeSeed( unsigned iPhi, unsigned iKappa ){
 
-    trk->setTypeBit( lcio::ILDDetID::TPC ) ; 
-   
-    double e = 0.0 ;
-    int nHit = 0 ;
-    for( CluTrack::iterator hi = c->begin(); hi != c->end() ; hi++) {
-      
-      // reset outliers (not used in fit)  bit
-      //      IMPL::TrackerHitImpl* thi = dynamic_cast<IMPL::TrackerHitImpl*> (  (*hi)->first->lcioHit )  ;
-      //      thi->setQualityBit( UTIL::ILDTrkHitQualityBit::USED_IN_FIT , 0 )  ;
+    computeKappaBins( iPhi ) ;
 
-      trk->addHit(  (*hi)->first->lcioHit ) ;
-      e += (*hi)->first->lcioHit->getEDep() ;
-      nHit++ ;
+    // the free hits in the cell - and the neighbouring kappa bins to allow for the binning 
+    _cand.clear() ;
+    for( unsigned i=0, N=_hits.size() ; i<N ; ++i ){
+      if( _kBin[i] + 1 >= iKappa  &&  _kBin[i] <= iKappa + 1  &&  _kBin[i] < _nKappa  &&  _hits[i]->second == 0 ) 
+	_cand.push_back( i ) ;
     }
 
-    MarlinTrk::IMarlinTrack* mtrk = c->ext<MarTrk>()  ;
+    if( _cand.size() < _minHits ) 
+      return 0 ;
 
-    trk->ext<MarTrk>()  = mtrk ;
+    //---- arc length s on the circle from the origin - straight line for small kappa 
+    const double kappa = ( iKappa + 0.5 ) / _kappaScale ;
+    const unsigned nCand = _cand.size() ;
 
-    trk->setdEdx( ( nHit ? e/nHit : -1. )  ) ;
-    trk->subdetectorHitNumbers().resize( 2 * lcio::ILDDetID::ETD ) ;
+    _s.resize( nCand ) ;
+    _res.resize( nCand ) ;
 
-    trk->subdetectorHitNumbers()[ 2*lcio::ILDDetID::TPC - 2 ] =  0 ; 
-    trk->subdetectorHitNumbers()[ 2*lcio::ILDDetID::TPC - 1 ] =  nHit ;  
-      
-    if( mtrk != 0 && ! c->empty() ){
-      
+    for( unsigned j=0 ; j<nCand ; ++j ){
+      double x = 0.5 * kappa * _rho[ _cand[j] ] ;
+      _s[j] = ( x < 1.e-3  ?  _rho[ _cand[j] ]  :  2. / kappa * std::asin( std::min( x , 1. ) ) ) ;
+    }
 
-      std::vector<std::pair<EVENT::TrackerHit*, double> > hitsInFit ;
-      mtrk->getHitsInFit( hitsInFit ) ;
-      trk->subdetectorHitNumbers()[ 2*lcio::ILDDetID::TPC - 2 ] =  hitsInFit.size() ;  
-      
-      if( ! hitsInFit.empty() ){
-	
-	// store the delta chi2 for the given hit
-	for(unsigned i=0, N=hitsInFit.size() ; i<N ; ++i){
-	  
-	  hitsInFit[i].first->ext<DChi2>() = hitsInFit[i].second ;
-	  
-	  //IMPL::TrackerHitImpl* thi = dynamic_cast<IMPL::TrackerHitImpl*> ( hitsInFit[i].first ) ;
-	  //thi->setQualityBit( UTIL::ILDTrkHitQualityBit::USED_IN_FIT , 1 )  ;
-	}
-	
-	lcio::TrackStateImpl* tsIP =  new lcio::TrackStateImpl ;
-	lcio::TrackStateImpl* tsFH =  new lcio::TrackStateImpl ;
-	lcio::TrackStateImpl* tsLH =  new lcio::TrackStateImpl ;
-	lcio::TrackStateImpl* tsCA =  new lcio::TrackStateImpl ;
-	
-	tsIP->setLocation(  lcio::TrackState::AtIP ) ;
-	tsFH->setLocation(  lcio::TrackState::AtFirstHit ) ;
-	tsLH->setLocation(  lcio::TrackState::AtLastHit) ;
-	tsCA->setLocation(  lcio::TrackState::AtCalorimeter ) ;
-	
-	double chi2 ;
-	int ndf  ;
-	int code ;
-	
-	// Hit* hf = c->front() ;
-	// Hit* hb = c->back() ;
-	// bool reverse_order =   ( std::abs( hf->first->pos.z() ) > std::abs( hb->first->pos.z()) + 3. ) ;
-	// lcio::TrackerHit* fHit =  ( reverse_order ?  hb->first->lcioHit  :  hf->first->lcioHit ) ;
-	// lcio::TrackerHit* lHit =  ( reverse_order ?  hf->first->lcioHit  :  hb->first->lcioHit ) ;
-	
-	lcio::TrackerHit* fHit = hitsInFit.back().first ;
-	lcio::TrackerHit* lHit = hitsInFit.front().first ;
-	//order of hits in fit is reversed wrt time  (we fit inwards)
-	
-	// ======= get TrackState at first hit  ========================
-	
-	code = mtrk->getTrackState( fHit, *tsFH, chi2, ndf ) ;
-	
-	if( code != MarlinTrk::IMarlinTrack::success ){
-	  
-	  streamlog_out( DEBUG6 ) << "  >>>>>>>>>>> LCIOTrackConverter :  could not get TrackState at first Hit !!?? " 
-				 << " error code : " << MarlinTrk::errorCode( code ) 
-				 << std::endl ; 
-	}
-	
-	// ======= get TrackState at last hit  ========================
+    //---- robust start values for the line z = z0 + tanL * s: medians of z/s and of z - tanL * s
+    _tmp.resize( nCand ) ;
+    for( unsigned j=0 ; j<nCand ; ++j )
+      _tmp[j] = _hits[ _cand[j] ]->first->pos.z() / _s[j] ;
 
-#define use_fit_at_last_hit 0
+    std::nth_element( _tmp.begin() , _tmp.begin() + nCand/2 , _tmp.end() ) ;
+    double tanL = _tmp[ nCand/2 ] ;
 
-#if use_fit_at_last_hit
-	  code = mtrk->getTrackState( lHit, *tsLH, chi2, ndf ) ;
-#else     // get the track state at the last hit by propagating from the last(first) constrained fit position (a la MarlinTrkUtils)
-	  EVENT::TrackerHit* last_constrained_hit = 0 ;     
-	  mtrk->getTrackerHitAtPositiveNDF( last_constrained_hit );
-	  code = mtrk->smooth() ;
-	  dd4hep::rec::Vector3D last_hit_pos( lHit->getPosition() );
-	  code = mtrk->propagate( last_hit_pos, last_constrained_hit, *tsLH, chi2, ndf);
+    for( unsigned j=0 ; j<nCand ; ++j )
+      _tmp[j] = _hits[ _cand[j] ]->first->pos.z() - tanL * _s[j] ;
 
-#endif
-	
-	if( code != MarlinTrk::IMarlinTrack::success ){
-	  
-	  streamlog_out( DEBUG6 ) << "  >>>>>>>>>>> LCIOTrackConverter :  could not get TrackState at last Hit !!?? " << std::endl ; 
-	}
-	
-	// ======= get TrackState at calo face  ========================
+    std::nth_element( _tmp.begin() , _tmp.begin() + nCand/2 , _tmp.end() ) ;
+    double z0 = _tmp[ nCand/2 ] ;
 
-	encoder.reset() ;
-	encoder[ lcio::LCTrackerCellID::subdet() ] = CaloFaceBarrelID ;
-	encoder[ lcio::LCTrackerCellID::layer()  ] =  0  ;
-	encoder[ lcio::LCTrackerCellID::side()   ] =  lcio::ILDDetID::barrel;
-	int layerID  = encoder.lowWord() ;  
-	int sensorID = -1 ;
-	
-#if use_fit_at_last_hit
-       	code = mtrk->propagateToLayer( layerID , lHit, *tsCA, chi2, ndf, sensorID, MarlinTrk::IMarlinTrack::modeClosest ) ;
-#else     // get the track state at the calorimter from a propagating from the last(first) constrained fit position
-	code = mtrk->propagateToLayer( layerID , last_constrained_hit, *tsCA, chi2, ndf, sensorID, MarlinTrk::IMarlinTrack::modeClosest ) ;
-#endif
-	
-	if( code ==  MarlinTrk::IMarlinTrack::no_intersection ){
-	  
-	  encoder[ lcio::LCTrackerCellID::subdet() ] = CaloFaceEndcapID ;
-	  encoder[ lcio::LCTrackerCellID::side()   ] = ( lHit->getPosition()[2] > 0.  ?   lcio::ILDDetID::fwd  :  lcio::ILDDetID::bwd  ) ;
+    //---- refit with the hits within zCut: the first fit selects the hits with the median start values, 
+    //     the second one with the refined line - further iterations hardly change the hit selection
+    static const int nRefits = 2 ;
+    for( int it=0 ; it<nRefits ; ++it ){
 
-	  layerID = encoder.lowWord() ;
-	  
-#if use_fit_at_last_hit
-	  code = mtrk->propagateToLayer( layerID , lHit, *tsCA, chi2, ndf, sensorID, MarlinTrk::IMarlinTrack::modeClosest ) ;
-#else     // get the track state at the calorimter from a propagating from the last(first) constrained fit position
-	  code = mtrk->propagateToLayer( layerID , last_constrained_hit, *tsCA, chi2, ndf, sensorID, MarlinTrk::IMarlinTrack::modeClosest ) ;
-#endif
+      double sw = 0., ss = 0., sz = 0., sss = 0., ssz = 0. ;
+
+      for( unsigned j=0 ; j<nCand ; ++j ){
+
+	double z = _hits[ _cand[j] ]->first->pos.z() ;
+
+	if( std::abs( z - z0 - tanL * _s[j] ) > _zCut ) 
+	  continue ;
+
+	sw  += 1. ;
+	ss  += _s[j] ;
+	sz  += z ;
+	sss += _s[j] * _s[j] ;
+	ssz += _s[j] * z ;
+      }
+
+      double det = sw * sss - ss * ss ;
+
+      if( sw < _minHits || std::abs( det ) < 1.e-9 ) 
+	return 0 ;
+
+      tanL = ( sw * ssz - ss * sz ) / det ;
+      z0   = ( sz - tanL * ss ) / sw ;
+    }
+
+    for( unsigned j=0 ; j<nCand ; ++j )
+      _res[j] = std::abs( _hits[ _cand[j] ]->first->pos.z() - z0 - tanL * _s[j] ) ;
+
+    //---- keep the hit with the smallest residual in every layer
+    CluTrack* clu = new CluTrack ;
+    _seedHits.clear() ;
+
+    for( unsigned j=0 ; j<nCand ; ++j ){
+
+      if( _res[j] > _zCut ) 
+	continue ;
+
+      Hit* h = _hits[ _cand[j] ] ;
+      bool best = true ;
+
+      for( unsigned k=0 ; k<nCand && best ; ++k ){
+
+	if( k == j || _res[k] > _zCut || _hits[ _cand[k] ]->first->layer != h->first->layer ) 
+	  continue ;
+
+	best = ( _res[j] < _res[k] || ( _res[j] == _res[k] && j < k ) ) ;
+      }
+
+      if( best ){
+	clu->addElement( h ) ;
+	_seedHits.push_back( _cand[j] ) ;
+      }
+    }
+
+    if( clu->size() < _minHits ){
+
+      clu->freeElements() ;
+      delete clu ;
+      return 0 ;
+    }
+
+    return clu ;
+  }
+
+  unsigned HoughSeeder::findSeeds( HitListVector& hitsInLayer, int outerRow, int padRowRange, Clusterer::cluster_list& seeds ){
+
+    //---- conformal coordinates of the free hits in the window
+    _hits.clear() ;
+    _u.clear() ;
+    _v.clear() ;
+    _rho.clear() ;
+
+    for( int l = outerRow ; l > outerRow - padRowRange && l > -1 ; --l ){
+      for( HitList::const_iterator it = hitsInLayer[l].begin(), end = hitsInLayer[l].end() ; it != end ; ++it ){
+
+	const dd4hep::rec::Vector3D& p = (*it)->first->pos ;
+	double r2 = p.x() * p.x() + p.y() * p.y() ;
+
+	if( r2 <= 0. ) 
+	  continue ;
+
+	_hits.push_back( *it ) ;
+	_u.push_back( p.x() / r2 ) ;
+	_v.push_back( p.y() / r2 ) ;
+	_rho.push_back( std::sqrt( r2 ) ) ;
+      }
+    }
+
+    if( _hits.size() < _minHits ) 
+      return 0 ;
+
+    _kBin.resize( _hits.size() ) ;
+
+    //---- fill the accumulators
+    const unsigned nRow = _nKappa + 1 ;
+
+    _acc.assign( _nPhi * nRow , 0 ) ;
+
+    for( unsigned iPhi=0 ; iPhi<_nPhi ; ++iPhi ){
+
+      computeKappaBins( iPhi ) ;
+
+      uint16_t* acc = &_acc[ iPhi * nRow ] ;
+
+      for( unsigned i=0, N=_hits.size() ; i<N ; ++i )
+	if( acc[ _kBin[i] ] < UINT16_MAX ) 
+	  ++acc[ _kBin[i] ] ;
+    }
+
+    //---- local maxima with at least minHits votes - phi is periodic
+    _peaks.clear() ;
+
+    for( unsigned iPhi=0 ; iPhi<_nPhi ; ++iPhi ){
+
+      const uint16_t* acc  = &_acc[ iPhi * nRow ] ;
+      const uint16_t* accL = &_acc[ ( ( iPhi + _nPhi - 1 ) % _nPhi ) * nRow ] ;
+      const uint16_t* accR = &_acc[ ( ( iPhi + 1 ) % _nPhi ) * nRow ] ;
+
+      for( unsigned iK=0 ; iK<_nKappa ; ++iK ){
+
+	unsigned n = acc[iK] ;
+
+	if( n < _minHits ) 
+	  continue ;
+
+	bool isMax = ( n >= accL[iK] && n > accR[iK] ) ;
+
+	if( iK > 0 )           isMax = isMax && n >= acc[iK-1] && n >= accL[iK-1] && n > accR[iK-1] ;
+	if( iK + 1 < _nKappa ) isMax = isMax && n >  acc[iK+1] && n >= accL[iK+1] && n > accR[iK+1] ;
+
+	if( isMax ) 
+	  _peaks.push_back( std::make_pair( n , iPhi * nRow + iK ) ) ;
+      }
+    }
+
+    // the largest peaks first - they take their hits from the smaller ones
+    std::sort( _peaks.begin() , _peaks.end() , 
+	       []( const std::pair<unsigned,unsigned>& l, const std::pair<unsigned,unsigned>& r ){ 
+		 return l.first > r.first || ( l.first == r.first && l.second < r.second ) ; } ) ;
+
+    unsigned nSeeds = 0 ;
+
+    for( unsigned i=0, N=_peaks.size() ; i<N ; ++i ){
+
+      // the votes of the hits taken by larger peaks have been removed 
+      if( _acc[ _peaks[i].second ] < _minHits ) 
+	continue ;
+
+      CluTrack* clu = makeSeed( _peaks[i].second / nRow , _peaks[i].second % nRow ) ;
+
+      if( clu == 0 ) 
+	continue ;
+
+      seeds.push_back( clu ) ;
+      ++nSeeds ;
+
+      // remove the votes of the seed hits - this suppresses the secondary maxima of the same track
+      for( unsigned j=0, M=_seedHits.size() ; j<M ; ++j ){
+
+	const float u = _u[ _seedHits[j] ] ;
+	const float v = _v[ _seedHits[j] ] ;
+
+	for( unsigned iPhi=0 ; iPhi<_nPhi ; ++iPhi ){
+
+	  uint16_t& n = _acc[ iPhi * nRow + kappaBin( u , v , _cosPhi[iPhi] , _sinPhi[iPhi] ) ] ;
+	  if( n > 0 ) 
+	    --n ;
+	}
+      }
+
+      for( CluTrack::iterator ci = clu->begin(), end = clu->end() ; ci != end ; ++ci )
+	hitsInLayer[ (*ci)->first->layer ].remove( *ci ) ;
+    }
+
+    streamlog_out( DEBUG3 ) << "  HoughSeeder: " << nSeeds << " seeds from " << _peaks.size() << " peaks in " 
+			    << _hits.size() << " hits " << std::endl ;
+
+    return nSeeds ;
+  }
+
+  //------------------------------------------------------------------------------------------------------------------------- 
+
+  CASeeder::CASeeder( double dCut, double maxKappa, double zTol, unsigned maxDoublets, unsigned minHits ) :
+    _dCut( dCut ), 
+    _maxKappa( maxKappa ), 
+    _zTol( zTol ), 
+    _maxDoublets( maxDoublets ), 
+    _minHits( minHits ) {
+  }
+
+  bool CASeeder::compatible( unsigned a, unsigned b, unsigned c ) const {
+
+    // the middle hit on the straight line through the outer hits in z vs. rho
+    double dRho = _rho[a] - _rho[c] ;
+
+    if( std::abs( dRho ) > 1.e-6 ){
+
+      double zPred = _z[c] + ( _z[a] - _z[c] ) * ( _rho[b] - _rho[c] ) / dRho ;
+
+      if( std::abs( _z[b] - zPred ) > _zTol ) 
+	return false ;
+    }
+
+    // curvature of the circle through the three hits: 2 * sin( angle at b ) / | a - c | 
+    double x1 = _x[b] - _x[a] , y1 = _y[b] - _y[a] ;
+    double x2 = _x[c] - _x[b] , y2 = _y[c] - _y[b] ;
+    double x3 = _x[c] - _x[a] , y3 = _y[c] - _y[a] ;
+
+    double cross = x1 * y2 - y1 * x2 ;
+    double norm  = std::sqrt( ( x1*x1 + y1*y1 ) * ( x2*x2 + y2*y2 ) * ( x3*x3 + y3*y3 ) ) ;
+
+    return 2. * std::abs( cross ) < _maxKappa * norm ;
+  }
+
+  unsigned CASeeder::findSeeds( HitListVector& hitsInLayer, int outerRow, int padRowRange, Clusterer::cluster_list& seeds ){
+
+    const int innerRow = std::max( outerRow - padRowRange + 1 , 0 ) ;
+    const int nRows = outerRow - innerRow + 1 ;
+
+    if( nRows < 2 ) 
+      return 0 ;
+
+    //---- the free hits of the window - from the innermost row, sorted in z in every row 
+    _hits.clear() ;
+    _hitOffset.resize( nRows + 1 ) ;
+
+    for( int r=0 ; r<nRows ; ++r ){
+
+      _hitOffset[r] = _hits.size() ;
+
+      const HitList& hl = hitsInLayer[ innerRow + r ] ;
+      _hits.insert( _hits.end() , hl.begin() , hl.end() ) ;
+
+      std::sort( _hits.begin() + _hitOffset[r] , _hits.end() , 
+		 []( const Hit* l, const Hit* h ){ return l->first->pos.z() < h->first->pos.z() ; } ) ;
+    }
+    _hitOffset[ nRows ] = _hits.size() ;
+
+    const unsigned nHit = _hits.size() ;
+
+    if( nHit < _minHits ) 
+      return 0 ;
+
+    _x.resize( nHit ) ;
+    _y.resize( nHit ) ;
+    _z.resize( nHit ) ;
+    _rho.resize( nHit ) ;
+
+    for( unsigned i=0 ; i<nHit ; ++i ){
+      const dd4hep::rec::Vector3D& p = _hits[i]->first->pos ;
+      _x[i]   = p.x() ;
+      _y[i]   = p.y() ;
+      _z[i]   = p.z() ;
+      _rho[i] = std::sqrt( p.x() * p.x() + p.y() * p.y() ) ;
+    }
+
+    //---- doublets to the next inner row - the nearest maxDoublets hits in neighbouring z bins within dCut
+    const double dCut2 = _dCut * _dCut ;
+
+    _dOuter.clear() ;
+    _dInner.clear() ;
+    _hitDoublets.assign( nHit + 1 , 0 ) ;
+
+    std::vector< std::pair< double, unsigned > >& cand = _cand ;
+
+    for( int r=0 ; r<nRows ; ++r ){
+
+      for( unsigned a = _hitOffset[r] ; a < _hitOffset[r+1] ; ++a ){
+
+	_hitDoublets[a] = _dOuter.size() ;
+
+	if( r == 0 ) 
+	  continue ;
+
+	const unsigned b0 = _hitOffset[r-1] , b1 = _hitOffset[r] ;
+	const int zIndexA = _hits[a]->first->zIndex ;
+
+	cand.clear() ;
+
+	for( unsigned b = std::lower_bound( _z.begin() + b0 , _z.begin() + b1 , _z[a] - _dCut ) - _z.begin() ; 
+	     b < b1 && _z[b] <= _z[a] + _dCut ; ++b ){
+
+	  if( std::abs( _hits[b]->first->zIndex - zIndexA ) > 1 ) 
+	    continue ;
+
+	  double dx = _x[a] - _x[b] , dy = _y[a] - _y[b] , dz = _z[a] - _z[b] ;
+	  double d2 = dx*dx + dy*dy + dz*dz ;
+
+	  if( d2 < dCut2 ) 
+	    cand.push_back( std::make_pair( d2 , b ) ) ;
+	}
+
+	if( cand.size() > _maxDoublets ){
+	  std::partial_sort( cand.begin() , cand.begin() + _maxDoublets , cand.end() ) ;
+	  cand.resize( _maxDoublets ) ;
+	}
+
+	for( unsigned i=0, N=cand.size() ; i<N ; ++i ){
+	  _dOuter.push_back( a ) ;
+	  _dInner.push_back( cand[i].second ) ;
+	}
+      }
+    }
+    _hitDoublets[ nHit ] = _dOuter.size() ;
+
+    const unsigned nDoublet = _dOuter.size() ;
+
+    //---- links to the compatible doublets at the inner hit 
+    _links.clear() ;
+    _linkOffset.resize( nDoublet + 1 ) ;
+
+    for( unsigned d=0 ; d<nDoublet ; ++d ){
+
+      _linkOffset[d] = _links.size() ;
+
+      const unsigned b = _dInner[d] ;
+
+      for( unsigned e = _hitDoublets[b] ; e < _hitDoublets[b+1] ; ++e )
+	if( compatible( _dOuter[d] , b , _dInner[e] ) ) 
+	  _links.push_back( e ) ;
+    }
+    _linkOffset[ nDoublet ] = _links.size() ;
+
+    //---- cellular automaton: the doublets are ordered from the inner rows and all links point to inner 
+    //     doublets, i.e. the final states are reached in one sweep
+    _state.resize( nDoublet ) ;
+
+    for( unsigned d=0 ; d<nDoublet ; ++d ){
+
+      unsigned s = 0 ;
+      for( unsigned l = _linkOffset[d] ; l < _linkOffset[d+1] ; ++l )
+	s = std::max( s , _state[ _links[l] ] ) ;
+
+      _state[d] = s + 1 ;
+    }
+
+    //---- extract the longest chains - a chain of n doublets has n+1 hits
+    _order.resize( nDoublet ) ;
+    for( unsigned d=0 ; d<nDoublet ; ++d ) 
+      _order[d] = d ;
+
+    std::stable_sort( _order.begin() , _order.end() , [this]( unsigned l, unsigned r ){ return _state[l] > _state[r] ; } ) ;
+
+    unsigned nSeeds = 0 ;
+
+    for( unsigned i=0 ; i<nDoublet ; ++i ){
+
+      unsigned d = _order[i] ;
+
+      if( _state[d] + 1 < _minHits ) 
+	break ;
+
+      if( _hits[ _dOuter[d] ]->second != 0 || _hits[ _dInner[d] ]->second != 0 ) 
+	continue ;
+
+      _chain.clear() ;
+      _chain.push_back( _dOuter[d] ) ;
+
+      for(;;){
+
+	_chain.push_back( _dInner[d] ) ;
+
+	// continue with the longest linked chain that starts at a free hit
+	int next = -1 ;
+	for( unsigned l = _linkOffset[d] ; l < _linkOffset[d+1] ; ++l ){
+
+	  unsigned e = _links[l] ;
+
+	  if( _hits[ _dInner[e] ]->second == 0  &&  ( next < 0 || _state[e] > _state[ next ] ) ) 
+	    next = e ;
+	}
+
+	if( next < 0 ) 
+	  break ;
+
+	d = next ;
+      }
+
+      if( _chain.size() < _minHits ) 
+	continue ;
+
+      CluTrack* clu = new CluTrack ;
+
+      for( unsigned j=0, N=_chain.size() ; j<N ; ++j ){
+
+	Hit* h = _hits[ _chain[j] ] ;
+
+	clu->addElement( h ) ;
+	hitsInLayer[ h->first->layer ].remove( h ) ;
+      }
+
+      seeds.push_back( clu ) ;
+      ++nSeeds ;
+    }
+
+    streamlog_out( DEBUG3 ) << "  CASeeder: " << nSeeds << " seeds from " << nDoublet << " doublets and " 
+			    << _links.size() << " links in " << nHit << " hits " << std::endl ;
+
+    return nSeeds ;
+  }
+
+  //------------------------------------------------------------------------------------------------------------------------- 
+
+  bool IMarlinTrkFitter::hitOrder( CluTrack* clu, std::vector< lcio::TrackerHit* >& hits, unsigned& nPrefix ) const {
+
+    clu->sort( LayerSortOut() ) ;
+    
+    // need to reverse the order for incomming track segments (curlers)
+    // assume particle comes from IP
+    Hit* hf = clu->front() ;
+    Hit* hb = clu->back() ;
+    
+    bool reverse_order =   ( std::abs( hf->first->pos.z() ) > std::abs( hb->first->pos.z()) + 3. ) ;
+
+    unsigned nHit = clu->size() ;
+    nPrefix = ( _nPrefixHits == 0 || nHit < _nPrefixHits  ?  nHit  :  _nPrefixHits ) ;
+
+    hits.clear() ;
+    hits.reserve( nHit ) ;
+
+    if( reverse_order ){
+
+      // from the innermost hit outwards
+      for( CluTrack::reverse_iterator it=clu->rbegin() ; it != clu->rend() ; ++it)
+	hits.push_back( (*it)->first->lcioHit ) ;
+
+    } else {
+
+      // the prefix are the innermost hits - in the order of the cluster - then the remaining hits from the inside out
+      CluTrack::iterator it = clu->begin() ;
+      std::advance( it , nHit - nPrefix ) ;
+
+      for( CluTrack::iterator end = clu->end() ; it != end ; ++it)
+	hits.push_back( (*it)->first->lcioHit ) ;
+
+      CluTrack::reverse_iterator rit = clu->rbegin() ;
+      std::advance( rit , nPrefix ) ;
+
+      for( CluTrack::reverse_iterator rend = clu->rend() ; rit != rend ; ++rit)
+	hits.push_back( (*rit)->first->lcioHit ) ;
+    }
+
+    return reverse_order ;
+  }
+
+  //------------------------------------------------------------------------------------------------------------------------- 
+
+  MarlinTrk::IMarlinTrack* IMarlinTrkFitter::operator() (CluTrack* clu) {  
+    
+    bool isFirstFit = true ;
+    double maxChi2  =  _maxChi2Increment   ;
+
+    // only the first nPrefixHits hits (in fit direction) are fitted in one go - if too few of them are used 
+    // in the fit we restart with a larger max-chi2-increment right away; the remaining hits are filtered one by one
+    const unsigned nPrefixHits    = _nPrefixHits ;
+    const double   minHitFraction = _minHitFraction ;
+    
+  start:
+    
+    MarlinTrk::IMarlinTrack* trk = _ts->createTrack();
+    
+    //if( clu->empty()  ){
+    if( clu->size() < 3  ){
+      
+      streamlog_out( ERROR ) << " IMarlinTrkFitter::operator() : cannot fit cluster track with less than 3 hits ! " << std::endl ;
+      
+      return trk ;
+    }
+    
+    clu->ext<MarTrk>() = trk ;
+    
+    // hits in the order they are added to the track - fitted in forward direction for reverse_order, backward otherwise
+    std::vector< lcio::TrackerHit* > hits ;
+    unsigned nPrefix = 0 ;
+
+    bool reverse_order = hitOrder( clu , hits , nPrefix ) ;
+
+    unsigned nHit = hits.size() ;
+
+    for( unsigned i = 0 ; i < nPrefix ; ++i ){   
+      
+      trk->addHit( hits[i] ) ; 
+      
+      streamlog_out( DEBUG1 ) <<  "   hit  added  " <<  *hits[i]   << std::endl ;
+    }
+
+    bool direction = ( reverse_order ? MarlinTrk::IMarlinTrack::forward : MarlinTrk::IMarlinTrack::backward ) ;
+      
+    trk->initialise( direction ) ;
+    
+    int code = trk->fit(  maxChi2  ) ;
+    
+    if( code != MarlinTrk::IMarlinTrack::success ){
+      
+      streamlog_out( ERROR ) << "  >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>> IMarlinTrkFitter :  problem fitting track "
+			     << " error code : " << MarlinTrk::errorCode( code ) 
+			     << std::endl ; 
+      
+      return trk ;
+    }
+    
+
+    //----- if the fit did not fail but has a small number of hits used in the prefix,
+    //      we try again one more time with a larger max-chi2-increment
+    
+    std::vector<std::pair<EVENT::TrackerHit*, double> > hitsInFit ;
+    trk->getHitsInFit( hitsInFit ) ;
+
+    if( isFirstFit  && ( 1.*hitsInFit.size()) / (1.*nPrefix )  <  minHitFraction  ) {
+      
+      isFirstFit = false ;
+      
+      maxChi2 =  2. * _maxChi2Increment  ;
+      
+      streamlog_out( DEBUG4 ) << "  >>>>>>  IMarlinTrkFitter :  small number of hits used in fit " << hitsInFit.size() << "/" << nPrefix << " = " 
+			      << ( 1.*hitsInFit.size()) / (1.*nPrefix )  << " refit with larger max chi2 increment:  " << maxChi2 <<  std::endl ;
+      delete trk ;
+
+      goto start ;   // ;-)
+    }
+    //----------------------------------------------------------------------
+
+    //----- now filter the remaining hits in fit direction, starting from the good prefix - if the running 
+    //      fraction of accepted hits gets too small, the max-chi2-increment is increased for the rest
+    
+    unsigned nTried    = 0 ;
+    unsigned nAccepted = 0 ;
+
+    for( unsigned j = nPrefix ; j < nHit ; ++j ){   
+
+      lcio::TrackerHit* hit = hits[ j ] ;
+
+      double deltaChi = 0. ;  
+
+      int addHit = trk->addAndFit( hit, deltaChi, maxChi2 ) ;
+
+      ++nTried ;
+
+      if( addHit == MarlinTrk::IMarlinTrack::success ) 
+	++nAccepted ;
+
+      streamlog_out( DEBUG1 ) <<  "   hit  filtered  " <<  *hit  << " : " << MarlinTrk::errorCode( addHit ) << " deltaChi2: " << deltaChi << std::endl ;
+
+      if( isFirstFit  &&  nTried >= nPrefixHits  &&  ( 1.*nAccepted ) / ( 1.*nTried )  <  minHitFraction  ) {
+
+	isFirstFit = false ;
+	
+	maxChi2 =  2. * _maxChi2Increment  ;
+
+	streamlog_out( DEBUG4 ) << "  >>>>>>  IMarlinTrkFitter :  small number of hits accepted " << nAccepted << "/" << nTried 
+				<< " - continue with larger max chi2 increment:  " << maxChi2 <<  std::endl ;
+      }
+    }
+
+    return trk;
+  }
+
+  //---------------------------------------------------------------------------------------------------------------------------
+
+  void replaceTrackState( lcio::TrackImpl* trk, lcio::TrackStateImpl* ts ){
+    
+    lcio::TrackStateVec& tsv = trk->trackStates() ;
+
+    for( unsigned i=0, N=tsv.size() ; i<N ; ++i ){
+
+      if( tsv[i]->getLocation() == ts->getLocation() ){
+
+	delete tsv[i] ;
+	tsv[i] = ts ;
+	return ;
+      }
+    }
+
+    if( ts->getLocation() == lcio::TrackState::AtIP ) 
+      tsv.insert( tsv.begin() , ts ) ;
+    else
+      tsv.push_back( ts ) ;
+  }
+
+  //---------------------------------------------------------------------------------------------------------------------------
+
+  /** helper for the track converter: propagate the track to the calorimeter face  - first try the barrel then the endcap */
+  int propagateToCaloFace( MarlinTrk::IMarlinTrack* mtrk, lcio::TrackerHit* hit, lcio::TrackStateImpl& tsCA, double& chi2, int& ndf, 
+			   unsigned caloFaceBarrelID, unsigned caloFaceEndcapID, double zLast ){
+    
+    lcio::BitField64 encoder( lcio::LCTrackerCellID::encoding_string() ) ; 
+    encoder[ lcio::LCTrackerCellID::subdet() ] = caloFaceBarrelID ;
+    encoder[ lcio::LCTrackerCellID::layer()  ] =  0  ;
+    encoder[ lcio::LCTrackerCellID::side()   ] =  lcio::ILDDetID::barrel;
+    int layerID  = encoder.lowWord() ;  
+    int sensorID = -1 ;
+    
+    int code = ( hit ? 
+		 mtrk->propagateToLayer( layerID , hit, tsCA, chi2, ndf, sensorID, MarlinTrk::IMarlinTrack::modeClosest ) :
+		 mtrk->propagateToLayer( layerID ,      tsCA, chi2, ndf, sensorID, MarlinTrk::IMarlinTrack::modeClosest ) ) ;
+    
+    if( code ==  MarlinTrk::IMarlinTrack::no_intersection ){
+      
+      encoder[ lcio::LCTrackerCellID::subdet() ] = caloFaceEndcapID ;
+      encoder[ lcio::LCTrackerCellID::side()   ] = ( zLast > 0.  ?   lcio::ILDDetID::fwd  :  lcio::ILDDetID::bwd  ) ;
+      
+      layerID = encoder.lowWord() ;
+      
+      code = ( hit ? 
+	       mtrk->propagateToLayer( layerID , hit, tsCA, chi2, ndf, sensorID, MarlinTrk::IMarlinTrack::modeClosest ) :
+	       mtrk->propagateToLayer( layerID ,      tsCA, chi2, ndf, sensorID, MarlinTrk::IMarlinTrack::modeClosest ) ) ;
+    }
+    
+    //fg: for curling tracks the propagated track has the wrong z0 whereas it should be 0. really 
+    if( std::abs( tsCA.getZ0() ) > std::abs( 2.*M_PI/tsCA.getOmega() * tsCA.getTanLambda() ) ){
+      
+      streamlog_out( DEBUG2 ) << "  >>>>>>>>>>> createTrackStateAtCaloFace : setting z0 to 0. for track state at calorimeter : " 
+			      << toString( &tsCA ) << std::endl ;
+      
+      tsCA.setZ0( 0. ) ;
+    } 
+
+    return code ;
+  }
+
+  //---------------------------------------------------------------------------------------------------------------------------
+
+  /** helper for the track converter: the track's hit that is closest to the given position */
+  lcio::TrackerHit* closestHit( const lcio::TrackerHitVec& hits, const dd4hep::rec::Vector3D& pos ){
+
+    lcio::TrackerHit* hit = 0 ;
+    double d2Min = DBL_MAX ;
+
+    for( unsigned i=0, N=hits.size() ; i<N ; ++i ){
+
+      double d2 = ( dd4hep::rec::Vector3D( hits[i]->getPosition() ) - pos ).r2() ;
+      
+      if( d2 < d2Min ){
+	d2Min = d2 ;
+	hit = hits[i] ;
+      }
+    }
+    return hit ;
+  }
+
+  //---------------------------------------------------------------------------------------------------------------------------
+
+   lcio::Track* LCIOTrackConverter::operator() (CluTrack* c) {  
+    
+    lcio::TrackImpl* trk = new lcio::TrackImpl ;
+
+    trk->setTypeBit( lcio::ILDDetID::TPC ) ; 
+   
+    // number of hits and energy deposit are taken from the cluster summary
+    const CluTrack::summary_type& cluSummary = c->summary() ;
+
+    double e = cluSummary.eDep ;
+    int nHit = cluSummary.size ;
+
+    for( CluTrack::iterator hi = c->begin(); hi != c->end() ; hi++) {
+      
+      // reset outliers (not used in fit)  bit
+      //      IMPL::TrackerHitImpl* thi = dynamic_cast<IMPL::TrackerHitImpl*> (  (*hi)->first->lcioHit )  ;
+      //      thi->setQualityBit( UTIL::ILDTrkHitQualityBit::USED_IN_FIT , 0 )  ;
+
+      trk->addHit(  (*hi)->first->lcioHit ) ;
+    }
+
+    MarlinTrk::IMarlinTrack* mtrk = c->ext<MarTrk>()  ;
+
+    trk->ext<MarTrk>()  = mtrk ;
+
+    trk->setdEdx( ( nHit ? e/nHit : -1. )  ) ;
+    trk->subdetectorHitNumbers().resize( 2 * lcio::ILDDetID::ETD ) ;
+
+    trk->subdetectorHitNumbers()[ 2*lcio::ILDDetID::TPC - 2 ] =  0 ; 
+    trk->subdetectorHitNumbers()[ 2*lcio::ILDDetID::TPC - 1 ] =  nHit ;  
+      
+    if( mtrk != 0 && ! c->empty() ){
+      
+
+      std::vector<std::pair<EVENT::TrackerHit*, double> > hitsInFit ;
+      mtrk->getHitsInFit( hitsInFit ) ;
+      trk->subdetectorHitNumbers()[ 2*lcio::ILDDetID::TPC - 2 ] =  hitsInFit.size() ;  
+      
+      if( ! hitsInFit.empty() ){
+	
+	// store the delta chi2 for the given hit - only needed for debugging (CED picking)
+	for(unsigned i=0, N=( ExportDChi2 ? hitsInFit.size() : 0 ) ; i<N ; ++i){
+	  
+	  hitsInFit[i].first->ext<DChi2>() = hitsInFit[i].second ;
+	  
+	  //IMPL::TrackerHitImpl* thi = dynamic_cast<IMPL::TrackerHitImpl*> ( hitsInFit[i].first ) ;
+	  //thi->setQualityBit( UTIL::ILDTrkHitQualityBit::USED_IN_FIT , 1 )  ;
+	}
+	
+	// only the track states requested in TrackStates are computed 
+	lcio::TrackStateImpl* tsIP =  ( TrackStates & AtIP          ?  new lcio::TrackStateImpl : 0 ) ;
+	lcio::TrackStateImpl* tsFH =  ( TrackStates & AtFirstHit    ?  new lcio::TrackStateImpl : 0 ) ;
+	lcio::TrackStateImpl* tsLH =  ( TrackStates & AtLastHit     ?  new lcio::TrackStateImpl : 0 ) ;
+	lcio::TrackStateImpl* tsCA =  ( TrackStates & AtCalorimeter ?  new lcio::TrackStateImpl : 0 ) ;
+	
+	double chi2 = 0. ;
+	int ndf  = 0 ;
+	int code ;
 
-	}
-	if ( code !=MarlinTrk::IMarlinTrack::success ) {
+	// chi2 and ndf of the fit for the lcio track - not those of the last track state computed
+	double fitChi2 = 0. ;
+	int fitNdf  = 0 ;
+	bool haveFitChi2 = false ;
+	
+	// Hit* hf = c->front() ;
+	// Hit* hb = c->back() ;
+	// bool reverse_order =   ( std::abs( hf->first->pos.z() ) > std::abs( hb->first->pos.z()) + 3. ) ;
+	// lcio::TrackerHit* fHit =  ( reverse_order ?  hb->first->lcioHit  :  hf->first->lcioHit ) ;
+	// lcio::TrackerHit* lHit =  ( reverse_order ?  hf->first->lcioHit  :  hb->first->lcioHit ) ;
+	
+	lcio::TrackerHit* fHit = hitsInFit.back().first ;
+	lcio::TrackerHit* lHit = hitsInFit.front().first ;
+	//order of hits in fit is reversed wrt time  (we fit inwards)
+	
+	// ======= get TrackState at first hit  ========================
+	
+	if( tsFH ){
+
+	  tsFH->setLocation(  lcio::TrackState::AtFirstHit ) ;
+
+	  code = mtrk->getTrackState( fHit, *tsFH, chi2, ndf ) ;
 	  
-	  streamlog_out( DEBUG6 ) << "  >>>>>>>>>>> LCIOTrackConverter :  could not get TrackState at calo face !!?? " << std::endl ;
+	  if( code != MarlinTrk::IMarlinTrack::success ){
+	    
+	    streamlog_out( DEBUG6 ) << "  >>>>>>>>>>> LCIOTrackConverter :  could not get TrackState at first Hit !!?? " 
+				    << " error code : " << MarlinTrk::errorCode( code ) 
+				    << std::endl ; 
+	  }
 	}
 	
-	//fg: for curling tracks the propagated track has the wrong z0 whereas it should be 0. really 
-	if( std::abs( tsCA->getZ0() ) > std::abs( 2.*M_PI/tsCA->getOmega() * tsCA->getTanLambda() ) ){
-	  
-	  streamlog_out( DEBUG2 ) << "  >>>>>>>>>>> createTrackStateAtCaloFace : setting z0 to 0. for track state at calorimeter : " 
-				  << toString(tsCA) << std::endl ;
-	  
-	  tsCA->setZ0( 0. ) ;
-	} 
+	// ======= get TrackState at last hit  ========================
 
-	// ======= get TrackState at IP ========================
-	
-	const dd4hep::rec::Vector3D ipv( 0.,0.,0. );
+#define use_fit_at_last_hit 0
+
+	EVENT::TrackerHit* last_constrained_hit = 0 ;     
+
+	if( tsLH ){
+
+	  tsLH->setLocation(  lcio::TrackState::AtLastHit) ;
+
+#if use_fit_at_last_hit
+	  code = mtrk->getTrackState( lHit, *tsLH, chi2, ndf ) ;
+#else     // get the track state at the last hit by propagating from the last(first) constrained fit position (a la MarlinTrkUtils)
+	  mtrk->getTrackerHitAtPositiveNDF( last_constrained_hit );
+	  code = mtrk->smooth() ;
+	  dd4hep::rec::Vector3D last_hit_pos( lHit->getPosition() );
+	  code = mtrk->propagate( last_hit_pos, last_constrained_hit, *tsLH, chi2, ndf);
+#endif
 	
-	// fg: propagate is quite slow  and might not really be needed for the TPC
+	  if( code != MarlinTrk::IMarlinTrack::success ){
+	    
+	    streamlog_out( DEBUG6 ) << "  >>>>>>>>>>> LCIOTrackConverter :  could not get TrackState at last Hit !!?? " << std::endl ; 
+	  }
+	}
 	
-	code = ( UsePropagate ?   mtrk->propagate( ipv, fHit, *tsIP, chi2, ndf ) :  mtrk->extrapolate( ipv, *tsIP, chi2, ndf ) ) ;
+	// ======= get TrackState at calo face  ========================
+
+	if( tsCA ){
+
+	  tsCA->setLocation(  lcio::TrackState::AtCalorimeter ) ;
+
+#if use_fit_at_last_hit
+	  code = propagateToCaloFace( mtrk, lHit, *tsCA, chi2, ndf, CaloFaceBarrelID, CaloFaceEndcapID, lHit->getPosition()[2] ) ;
+#else     // get the track state at the calorimter from a propagating from the last(first) constrained fit position
+	  if( ! last_constrained_hit ){
+	    mtrk->getTrackerHitAtPositiveNDF( last_constrained_hit );
+	    mtrk->smooth() ;
+	  }
+	  code = propagateToCaloFace( mtrk, last_constrained_hit, *tsCA, chi2, ndf, CaloFaceBarrelID, CaloFaceEndcapID, lHit->getPosition()[2] ) ;
+#endif
+
+	  if ( code !=MarlinTrk::IMarlinTrack::success ) {
+	    
+	    streamlog_out( DEBUG6 ) << "  >>>>>>>>>>> LCIOTrackConverter :  could not get TrackState at calo face !!?? " << std::endl ;
+	  }
+	}
+
+	// ======= get TrackState at IP ========================
 	
-	if( code != MarlinTrk::IMarlinTrack::success ){
+	if( tsIP ){
+
+	  tsIP->setLocation(  lcio::TrackState::AtIP ) ;
+
+	  const dd4hep::rec::Vector3D ipv( 0.,0.,0. );
 	  
-	  streamlog_out( DEBUG6 ) << "  >>>>>>>>>>> LCIOTrackConverter :  could not extrapolate TrackState to IP !!?? " << std::endl ; 
+	  // fg: propagate is quite slow  and might not really be needed for the TPC
+	  
+	  code = ( UsePropagate ?   mtrk->propagate( ipv, fHit, *tsIP, chi2, ndf ) :  mtrk->extrapolate( ipv, *tsIP, chi2, ndf ) ) ;
+	  
+	  if( code != MarlinTrk::IMarlinTrack::success ){
+	    
+	    streamlog_out( DEBUG6 ) << "  >>>>>>>>>>> LCIOTrackConverter :  could not extrapolate TrackState to IP !!?? " << std::endl ; 
+
+	  } else {
+
+	    fitChi2 = chi2 ;
+	    fitNdf  = ndf ;
+	    haveFitChi2 = true ;
+	  }
+	}
+
+	if( ! haveFitChi2 ){ // no state at the IP - take chi2 and ndf from the fit 
+
+	  lcio::TrackStateImpl ts ;
+	  mtrk->getTrackState( ts, fitChi2, fitNdf ) ;
 	}
 	
-	trk->addTrackState( tsIP ) ;
-	trk->addTrackState( tsFH ) ;
-	trk->addTrackState( tsLH ) ;
-	trk->addTrackState( tsCA ) ;
+	if( tsIP ) trk->addTrackState( tsIP ) ;
+	if( tsFH ) trk->addTrackState( tsFH ) ;
+	if( tsLH ) trk->addTrackState( tsLH ) ;
+	if( tsCA ) trk->addTrackState( tsCA ) ;
 	
-	double RMin = sqrt( tsFH->getReferencePoint()[0] * tsFH->getReferencePoint()[0]
-			    + tsFH->getReferencePoint()[1] * tsFH->getReferencePoint()[1] ) ;
+	dd4hep::rec::Vector3D fhPos( tsFH ? dd4hep::rec::Vector3D( tsFH->getReferencePoint() ) : dd4hep::rec::Vector3D( fHit->getPosition() ) ) ;
+
+	double RMin = fhPos.rho() ;
 	
 	trk->setRadiusOfInnermostHit( RMin  ) ; 
 	
-	trk->setChi2( chi2 ) ;
-	trk->setNdf( ndf ) ;
+	trk->setChi2( fitChi2 ) ;
+	trk->setNdf( fitNdf ) ;
 
       } else {
 
@@ -1302,5 +2190,414 @@ namespace clupatra_new{
     return trk ;
   }
 
+  //---------------------------------------------------------------------------------------------------------------------------
+
+  void LCIOTrackConverter::addTrackStates( lcio::TrackImpl* trk, unsigned states, MarlinTrk::IMarlinTrkSystem* trkSys, double bfield ) const {
+    
+    const lcio::TrackerHitVec& hits = trk->getTrackerHits() ;
+
+    if( hits.empty() ) 
+      return ;
+
+    double chi2 ;
+    int ndf  ;
+    int code ;
+
+    // ======= get TrackState at IP - propagated from the first hit  ========================
+
+    const lcio::TrackState* tsFH = trk->getTrackState( lcio::TrackState::AtFirstHit ) ;
+    
+    if( ( states & AtIP ) && tsFH ){
+      
+      dd4hep::rec::Vector3D fhPos( tsFH->getReferencePoint() ) ;
+
+      std::unique_ptr<MarlinTrk::IMarlinTrack> mTrk( trkSys->createTrack()  ) ;
+
+      //need to add a dummy hit to the track
+      mTrk->addHit( closestHit( hits, fhPos ) ) ; 
+
+      mTrk->initialise( *tsFH ,  bfield ,  MarlinTrk::IMarlinTrack::backward ) ;
+
+      lcio::TrackStateImpl* tsIP =  new lcio::TrackStateImpl ;
+
+      const dd4hep::rec::Vector3D ipv( 0.,0.,0. );
+
+      code = mTrk->propagate( ipv, *tsIP, chi2, ndf ) ;
+
+      if( code == MarlinTrk::IMarlinTrack::success ){
+
+	tsIP->setLocation(  lcio::TrackState::AtIP ) ;
+
+	replaceTrackState( trk, tsIP ) ;
+
+      } else {
+
+	streamlog_out( DEBUG6 ) << "  >>>>>>>>>>> LCIOTrackConverter::addTrackStates :  could not propagate TrackState to IP !!?? " << std::endl ; 
+	delete tsIP ;
+      }
+    }
+
+    // ======= get TrackState at calo face - propagated from the last hit  ========================
+
+    const lcio::TrackState* tsLH = trk->getTrackState( lcio::TrackState::AtLastHit ) ;
+
+    if( ( states & AtCalorimeter ) && tsLH ){
+      
+      dd4hep::rec::Vector3D lhPos( tsLH->getReferencePoint() ) ;
+
+      std::unique_ptr<MarlinTrk::IMarlinTrack> mTrk( trkSys->createTrack()  ) ;
+
+      //need to add a dummy hit to the track
+      mTrk->addHit( closestHit( hits, lhPos ) ) ; 
+
+      mTrk->initialise( *tsLH ,  bfield ,  MarlinTrk::IMarlinTrack::forward ) ;
+
+      lcio::TrackStateImpl* tsCA =  new lcio::TrackStateImpl ;
+
+      code = propagateToCaloFace( mTrk.get() , 0 , *tsCA, chi2, ndf, CaloFaceBarrelID, CaloFaceEndcapID, lhPos.z() ) ;
+
+      if( code == MarlinTrk::IMarlinTrack::success ){
+
+	tsCA->setLocation(  lcio::TrackState::AtCalorimeter ) ;
+
+	replaceTrackState( trk, tsCA ) ;
+
+      } else {
+
+	streamlog_out( DEBUG6 ) << "  >>>>>>>>>>> LCIOTrackConverter::addTrackStates :  could not get TrackState at calo face !!?? " << std::endl ;
+	delete tsCA ;
+      }
+    }
+  }
+
+
+  //---------------------------------------------------------------------------------------------------------------------------
+
+  Hit* ClupaWorkspace::hit( lcio::TrackerHit* th ){
+
+    if( _hitLookup.empty() && ! hitPool.empty() ){
+
+      _hitLookup.reserve( hitPool.size() ) ;
+
+      for( unsigned i=0, N=hitPool.size() ; i<N ; ++i )
+	_hitLookup.push_back( std::make_pair( hitPool[i].first->lcioHit , &hitPool[i] ) ) ;
+
+      std::sort( _hitLookup.begin() , _hitLookup.end() ) ;
+    }
+
+    std::vector< std::pair< lcio::TrackerHit*, Hit* > >::const_iterator it = 
+      std::lower_bound( _hitLookup.begin() , _hitLookup.end() , std::make_pair( th , (Hit*) 0 ) ) ;
+
+    return ( it != _hitLookup.end() && it->first == th  ?  it->second  :  0 ) ;
+  }
+
+  //---------------------------------------------------------------------------------------------------------------------------
+
+  void ClupaWorkspace::sortHitsInZ(){
+
+    const unsigned nHit = nncluHits.size() ;
+    
+    // map the float z to an unsigned key with the same order: flip all bits of negative 
+    // numbers and the sign bit of positive ones
+    _zKeys.resize( nHit ) ;
+    _zKeysTmp.resize( nHit ) ;
+
+    for( unsigned i=0 ; i<nHit ; ++i ){
+
+      float z = nncluHits[i]->first->pos.z() ;
+      unsigned key ;
+      std::memcpy( &key, &z, sizeof(key) ) ;
+
+      key ^= ( key & 0x80000000u  ?  0xffffffffu  :  0x80000000u ) ;
+
+      _zKeys[i] = std::make_pair( key , nncluHits[i] ) ;
+    }
+
+    // LSD radix sort with three passes of 11 bits  
+    static const unsigned nBits = 11 ;
+    static const unsigned nBuckets = 1 << nBits ;
+    unsigned count[ nBuckets ] ;
+
+    for( unsigned shift = 0 ; shift < 32 ; shift += nBits ){
+
+      std::fill( count , count + nBuckets , 0 ) ;
+
+      for( unsigned i=0 ; i<nHit ; ++i )
+	++count[ ( _zKeys[i].first >> shift ) & ( nBuckets - 1 ) ] ;
+
+      unsigned sum = 0 ;
+      for( unsigned b=0 ; b<nBuckets ; ++b ){
+	unsigned c = count[b] ;
+	count[b] = sum ;
+	sum += c ;
+      }
+
+      for( unsigned i=0 ; i<nHit ; ++i )
+	_zKeysTmp[ count[ ( _zKeys[i].first >> shift ) & ( nBuckets - 1 ) ]++ ] = _zKeys[i] ;
+
+      _zKeys.swap( _zKeysTmp ) ;
+    }
+
+    for( unsigned i=0 ; i<nHit ; ++i )
+      nncluHits[i] = _zKeys[i].second ;
+  }
+
+  //---------------------------------------------------------------------------------------------------------------------------
+
+  SliceCarryOver::~SliceCarryOver(){
+
+    // hits that have not been handed over to an event
+    reset() ;
+  }
+
+  lcio::LCCollectionVec* SliceCarryOver::takeHits(){
+
+    LCCollectionVec* col = new LCCollectionVec( LCIO::TRACKERHIT ) ;
+    col->parameters().setValue( LCIO::CellIDEncoding , LCTrackerCellID::encoding_string() ) ;
+    col->reserve( _hits.size() ) ;
+
+    _age.clear() ;
+
+    for( unsigned i=0, N=_hits.size() ; i<N ; ++i ){
+      col->push_back( _hits[i] ) ;
+      _age[ _hits[i] ] = _hitAges[i] ;
+    }
+
+    _hits.clear() ;
+    _hitAges.clear() ;
+
+    return col ;
+  }
+
+  unsigned SliceCarryOver::reset(){
+
+    unsigned nCand = _candidates.size() ;
+
+    for( unsigned i=0, N=_hits.size() ; i<N ; ++i )
+      delete _hits[i] ;
+
+    _hits.clear() ;
+    _hitAges.clear() ;
+    _candidates.clear() ;
+    _copyIndex.clear() ;
+    _age.clear() ;
+    _seen.clear() ;
+
+    return nCand ;
+  }
+
+  int SliceCarryOver::carry( lcio::TrackerHit* th, unsigned age ){
+
+    std::unordered_map< const lcio::TrackerHit*, int >::const_iterator it = _copyIndex.find( th ) ;
+
+    if( it != _copyIndex.end() ) 
+      return it->second ;
+
+    TrackerHitImpl* c = new TrackerHitImpl ;
+    c->setCellID0(    th->getCellID0() ) ;
+    c->setCellID1(    th->getCellID1() ) ;
+    c->setType(       th->getType() ) ;
+    c->setPosition(   th->getPosition() ) ;
+    c->setCovMatrix(  th->getCovMatrix() ) ;
+    c->setEDep(       th->getEDep() ) ;
+    c->setEDepError(  th->getEDepError() ) ;
+    c->setTime(       th->getTime() ) ;
+    c->setQuality(    th->getQuality() ) ;
+
+    _hits.push_back( c ) ;
+    _hitAges.push_back( age ) ;
+
+    return ( _copyIndex[ th ] = _hits.size() - 1 ) ;
+  }
+
+  unsigned SliceCarryOver::endSlice( lcio::LCCollection* col, const HitVec& hits, lcio::LCCollectionVec* trkCol, lcio::LCCollectionVec* segCol ){
+
+    _candidates.clear() ;
+    _copyIndex.clear() ;
+
+    // hits of this slice that show up again in the next (overlapping) slice are skipped there
+    _seen.clear() ;
+    for( int i=0, N=col->getNumberOfElements() ; i<N ; ++i )
+      _seen.insert( HitKey( static_cast<TrackerHit*>( col->getElementAt(i) ) ) ) ;
+
+    if( hits.empty() ) 
+      return 0 ;
+
+    float tMax = hits.front()->first->lcioHit->getTime() ;
+    for( HitVec::const_iterator it = hits.begin(), end = hits.end() ; it != end ; ++it )
+      tMax = std::max( tMax , (*it)->first->lcioHit->getTime() ) ;
+
+    const float tBoundary = tMax - _overlapTime ;
+
+    unsigned nDeferred = 0 ;
+
+    for( int i=trkCol->getNumberOfElements()-1 ; i>=0 ; --i ){
+
+      TrackImpl* trk = static_cast<TrackImpl*>( trkCol->getElementAt(i) ) ;
+
+      // only the track's own hits are carried over - merged curler segments stay separate
+      const TrackerHitVec& tHits = trk->getTrackerHits() ;
+
+      bool atBoundary = false ;
+      unsigned age = 0 ;
+
+      for( unsigned j=0, N=tHits.size() ; j<N ; ++j ){
+
+	if( tHits[j]->getTime() > tBoundary ) 
+	  atBoundary = true ;
+
+	std::unordered_map< const lcio::TrackerHit*, unsigned >::const_iterator ia = _age.find( tHits[j] ) ;
+	if( ia != _age.end() && ia->second > age ) 
+	  age = ia->second ;
+      }
+
+      if( ! atBoundary || age >= _maxSlices ) 
+	continue ;
+
+      _candidates.push_back( std::vector<int>() ) ;
+      std::vector<int>& cand = _candidates.back() ;
+      cand.reserve( tHits.size() ) ;
+
+      for( unsigned j=0, N=tHits.size() ; j<N ; ++j )
+	cand.push_back( carry( tHits[j] , age + 1 ) ) ;
+
+      // the track is kept as segment in this slice - it is emitted once it is complete
+      trkCol->removeElementAt( i ) ;
+
+      if( segCol ){
+	trk->setTypeBit( ILDTrackTypeBit::SEGMENT ) ;
+	segCol->addElement( trk ) ;
+      } else {
+	delete trk ;   // a copy - the segment is already in the segment collection
+      }
+
+      ++nDeferred ;
+    }
+
+    // unused hits in the boundary region can still be picked up by tracks in the next slice
+    for( HitVec::const_iterator it = hits.begin(), end = hits.end() ; it != end ; ++it ){
+
+      lcio::TrackerHit* th = (*it)->first->lcioHit ;
+
+      if( (*it)->second != 0 || th->getTime() <= tBoundary ) 
+	continue ;
+
+      std::unordered_map< const lcio::TrackerHit*, unsigned >::const_iterator ia = _age.find( th ) ;
+      unsigned age = ( ia != _age.end()  ?  ia->second  :  0 ) ;
+
+      if( age < _maxSlices )
+	carry( th , age + 1 ) ;
+    }
+
+    return nDeferred ;
+  }
+
+  //---------------------------------------------------------------------------------------------------------------------------
+
+  void SiHitIndex::clear(){
+    _entries.clear() ;
+    _sensors.clear() ;
+  }
+
+  void SiHitIndex::sort(){
+
+    _sensors.clear() ;
+
+    std::sort( _entries.begin() , _entries.end() , 
+	       []( const Entry& l, const Entry& r ){ return l.sensorID < r.sensorID ; } ) ;
+
+    for( unsigned i=0, N=_entries.size() ; i<N ; ){
+
+      Sensor sen ;
+      sen.sensorID = _entries[i].sensorID ;
+      sen.begin = i ;
+
+      while( i < N && _entries[i].sensorID == sen.sensorID ) 
+	++i ;
+
+      sen.end = i ;
+
+      // all hits on a planar sensor have the same measurement direction
+      const TrackerHitPlane* hp = dynamic_cast<const TrackerHitPlane*>( _entries[ sen.begin ].hit ) ;
+
+      sen.uDir = ( hp ? 
+		   dd4hep::rec::Vector3D( 1. , hp->getU()[1] ,  hp->getU()[0] , dd4hep::rec::Vector3D::spherical ) :
+		   dd4hep::rec::Vector3D( 0., 0., 1. ) ) ;
+
+      for( unsigned j = sen.begin ; j < sen.end ; ++j )
+	_entries[j].u = dd4hep::rec::Vector3D( _entries[j].hit->getPosition() ).dot( sen.uDir ) ;
+
+      std::sort( _entries.begin() + sen.begin , _entries.begin() + sen.end , 
+		 []( const Entry& l, const Entry& r ){ return l.u < r.u ; } ) ;
+
+      _sensors.push_back( sen ) ;
+    }
+  }
+
+  const SiHitIndex::Sensor* SiHitIndex::findSensor( int sensorID ) const {
+
+    std::vector< Sensor >::const_iterator it = 
+      std::lower_bound( _sensors.begin() , _sensors.end() , sensorID , 
+			[]( const Sensor& s, int id ){ return s.sensorID < id ; } ) ;
+
+    return ( it != _sensors.end() && it->sensorID == sensorID  ?  &(*it)  :  0 ) ;
+  }
+
+  unsigned SiHitIndex::nHits( int sensorID ) const {
+
+    const Sensor* sen = findSensor( sensorID ) ;
+
+    return ( sen ?  sen->end - sen->begin  :  0 ) ;
+  }
+
+  int SiHitIndex::findClosest( int sensorID, const dd4hep::rec::Vector3D& point, Metric metric, double& d2 ) const {
+
+    d2 = DBL_MAX ;
+
+    const Sensor* sen = findSensor( sensorID ) ;
+
+    if( sen == 0 ) 
+      return -1 ;
+
+    double u0 = point.dot( sen->uDir ) ;
+
+    std::vector< Entry >::const_iterator first = _entries.begin() + sen->begin ;
+    std::vector< Entry >::const_iterator last  = _entries.begin() + sen->end ;
+
+    int iu = std::lower_bound( first , last , u0 , []( const Entry& e, double u ){ return e.u < u ; } ) - _entries.begin() ;
+
+    int best = -1 ;
+
+    // walk outwards from u0 in both directions - the distance in u is a lower bound for both metrics 
+    int up = iu , down = iu - 1 ;
+
+    while( up < int( sen->end ) || down >= int( sen->begin ) ){
+
+      bool goUp = ( down < int( sen->begin ) || 
+		    ( up < int( sen->end ) && _entries[up].u - u0 < u0 - _entries[down].u ) ) ;
+
+      int i = ( goUp ? up++ : down-- ) ;
+
+      const Entry& e = _entries[i] ;
+
+      double du = e.u - u0 ;
+
+      if( du * du >= d2 ) 
+	break ;
+
+      if( e.used ) 
+	continue ;
+
+      double d = ( metric == StripDistance  ?  du * du  :  ( dd4hep::rec::Vector3D( e.hit->getPosition() ) - point ).r2()  ) ;
+
+      if( d < d2 ){
+	d2 = d ;
+	best = i ;
+      }
+    }
+
+    return best ;
+  }
+
 
 }//namespace
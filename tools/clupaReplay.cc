@@ -0,0 +1,187 @@
+/** clupaReplay: replays Clupatra snapshot files written with the ClupatraProcessor parameter SnapshotFile.
+ *
+ *  The TPC hits are taken from the memory mapped snapshot and the hit preparation and the NN seed
+ *  clustering of Clupatra are run for every event - without LCIO input files and without loading the
+ *  DD4hep geometry, so that these steps can be profiled with a short turnaround. The extension of the
+ *  seeds with the Kalman filter needs MarlinTrk and the full geometry and is not part of the replay.
+ *
+ *  usage: clupaReplay snapshotFile [nRepeat=1] [DistanceCut=40.] [PadRowRange=12] [NLoopForSeeding=4] [MinimumClusterSize=6] [SeedingEngine=NNWindows|Hough|CA]
+ *
+ *  @author F.Gaede, DESY
+ *  @version $Id$
+ */
+
+#include "clupatra_new.h"
+#include "ClupaSnapshot.h"
+
+#include "IMPL/TrackerHitImpl.h"
+#include "UTIL/LCTrackerConf.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <chrono>
+
+using namespace clupatra_new ;
+
+
+int main( int argc, char** argv ){
+
+  if( argc < 2 ){
+    std::cout << " usage: clupaReplay snapshotFile [nRepeat=1] [DistanceCut=40.] [PadRowRange=12] [NLoopForSeeding=4] [MinimumClusterSize=6] [SeedingEngine=NNWindows|Hough|CA]"
+	      << std::endl ;
+    return 1 ;
+  }
+
+  // the defaults are those of the ClupatraProcessor parameters
+  const int    nRepeat                 = ( argc > 2 ?  std::atoi( argv[2] )  :  1 ) ;
+  const double distCut                 = ( argc > 3 ?  std::atof( argv[3] )  :  40. ) ;
+  const int    padRowRange             = ( argc > 4 ?  std::atoi( argv[4] )  :  12 ) ;
+  const int    nLoop                   = ( argc > 5 ?  std::atoi( argv[5] )  :  4 ) ;
+  const int    minCluSize              = ( argc > 6 ?  std::atoi( argv[6] )  :  6 ) ;
+  const std::string seedingEngine      = ( argc > 7 ?  argv[7]  :  "NNWindows" ) ;
+  const double cosAlphaCut             = 0.9999999 ;
+  const float  duplicatePadRowFraction = 0.1 ;
+  const int    nZBins                  = 150 ;
+
+  try{
+
+    SnapshotReader reader( argv[1] ) ;
+
+    const SnapshotHeader& geo = reader.header() ;
+
+    std::cout << " clupaReplay: TPC with " << geo.maxRow << " pad rows, drift length " << geo.driftLength
+	      << " mm, readout [" << geo.rMinReadout << "," << geo.rMaxReadout << "] mm, B = " << geo.bField << " T" << std::endl ;
+
+    const unsigned maxTPCLayers = geo.maxRow ;
+
+    const double driftLength = geo.driftLength ;
+
+    ZIndex zIndex( -driftLength , driftLength , nZBins ) ;
+
+    // the Hough and CA seeding with the default parameters of the ClupatraProcessor
+    std::unique_ptr<HoughSeeder> houghSeeder ;
+    if( seedingEngine == "Hough" )
+      houghSeeder.reset( new HoughSeeder( 360 , 128 , 2. / geo.rMinReadout , 20. , minCluSize ) ) ;
+
+    std::unique_ptr<CASeeder> caSeeder ;
+    if( seedingEngine == "CA" )
+      caSeeder.reset( new CASeeder( distCut , 0.03 , 5. , 8 , minCluSize ) ) ;
+
+    const CellIDField layerField( UTIL::LCTrackerCellID::encoding_string() , UTIL::LCTrackerCellID::layer() ) ;
+
+    ClupaWorkspace ws ;
+    std::vector< IMPL::TrackerHitImpl > lcioHits ;
+
+    double tPrepare = 0. , tSeeding = 0. ;
+    unsigned long nEvt = 0 , nHitTotal = 0 , nSeeds = 0 , nSeedHits = 0 ;
+
+    for( int iRep = 0 ; iRep < nRepeat ; ++iRep ){
+
+      reader.rewind() ;
+
+      const SnapshotEvent* evt = 0 ;
+      const SnapshotHit* sHits = 0 ;
+
+      while( reader.next( evt , sHits ) ){
+
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now() ;
+
+	//----- create the lcio hits and the clupa and clustering hits - as in ClupatraProcessor::processEvent()
+	const unsigned nHit = evt->nHit ;
+
+	lcioHits.clear() ;
+	lcioHits.resize( nHit ) ;
+
+	ws.reset( nHit , maxTPCLayers ) ;
+
+	for( unsigned i=0 ; i < nHit ; ++i ){
+
+	  const SnapshotHit& sh = sHits[i] ;
+	  IMPL::TrackerHitImpl* th = &lcioHits[i] ;
+
+	  th->setPosition( sh.pos ) ;
+	  th->setCovMatrix( sh.cov ) ;
+	  th->setCellID0( sh.cellID0 ) ;
+	  th->setCellID1( sh.cellID1 ) ;
+	  th->setEDep( sh.eDep ) ;
+	  th->setTime( sh.time ) ;
+
+	  if ( std::abs( sh.pos[2] ) > driftLength ) continue;
+
+	  ClupaHit* ch  = & ws.clupaHits[i] ;
+
+	  ch->lcioHit = th ;
+	  ch->pos     = dd4hep::rec::Vector3D( sh.pos ) ;
+	  ch->layer   = layerField( th ) ;
+	  ch->zIndex  = zIndex.index( sh.pos[2] ) ;
+
+	  ws.hitPool.push_back( Hit( ch ) ) ;
+	  ws.nncluHits.push_back( &ws.hitPool.back() ) ;
+	}
+
+	ws.sortHitsInZ() ;
+
+	addToHitListVector( ws.nncluHits.begin(), ws.nncluHits.end() , ws.hitsInLayer ) ;
+
+	std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now() ;
+
+	//----- seed clustering in pad row windows with increasing distance cuts
+	Clusterer::cluster_list seeds ;
+	seeds.setOwner() ;
+
+	double dcut = distCut / nLoop ;
+
+	const int nSeedLoops = ( houghSeeder || caSeeder  ?  1  :  nLoop ) ;
+
+	for( int nloop=1 ; nloop <= nSeedLoops ; ++nloop ){
+
+	  int outerRow = maxTPCLayers - 1 ;
+
+	  while( outerRow >= minCluSize ) {
+
+	    Clusterer::cluster_list sclu ;
+	    sclu.setOwner() ;
+
+	    if( houghSeeder )
+	      houghSeeder->findSeeds( ws.hitsInLayer , outerRow , padRowRange , sclu ) ;
+	    else if( caSeeder )
+	      caSeeder->findSeeds( ws.hitsInLayer , outerRow , padRowRange , sclu ) ;
+	    else
+	      findSeedClusters( ws.hitsInLayer , ws.windowHits , outerRow , padRowRange , nloop * dcut , cosAlphaCut ,
+				minCluSize , maxTPCLayers , duplicatePadRowFraction , sclu ) ;
+
+	    for( Clusterer::cluster_list::iterator it = sclu.begin() ; it != sclu.end() ; ++it )
+	      nSeedHits += (*it)->size() ;
+
+	    nSeeds += sclu.size() ;
+
+	    seeds.merge( sclu ) ;
+
+	    outerRow -= padRowRange ;
+	  }
+	}
+
+	std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now() ;
+
+	tPrepare += std::chrono::duration<double>( t1 - t0 ).count() ;
+	tSeeding += std::chrono::duration<double>( t2 - t1 ).count() ;
+
+	++nEvt ;
+	nHitTotal += nHit ;
+      }
+    }
+
+    std::cout << " clupaReplay: " << seedingEngine << " seeding, " << nEvt << " events, " << nHitTotal << " hits, " << nSeeds << " seed clusters with "
+	      << nSeedHits << " hits \n"
+	      << "   hit preparation : " << tPrepare << " s  ( " << ( nEvt ? 1.e3 * tPrepare / nEvt : 0. ) << " ms / event ) \n"
+	      << "   seed clustering : " << tSeeding << " s  ( " << ( nEvt ? 1.e3 * tSeeding / nEvt : 0. ) << " ms / event ) "
+	      << std::endl ;
+
+  } catch( lcio::Exception& e ){
+
+    std::cout << " clupaReplay: " << e.what() << std::endl ;
+    return 1 ;
+  }
+
+  return 0 ;
+}